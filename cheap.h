@@ -1,15 +1,49 @@
 // ReSharper disable CppNonInlineFunctionDefinitionInHeaderFile
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <span>
 #include <stdexcept>
 #include <string>
+#include <tuple>
+#include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
+#if __has_include(<sys/uio.h>)
+#include <sys/uio.h>
+#define CHEAP_HAS_IOVEC
+#endif
+
+#ifdef CHEAP_USE_FMT
+#include <fmt/format.h>
+#endif
+#if __has_include(<format>)
+#include <format>
+#endif
+#ifdef __cpp_lib_format
+#define CHEAP_HAS_STD_FORMAT
+#endif
+
 
 namespace cheap
 {
+   // Handling of text that isn't valid UTF-8. validate throws, replace writes U+FFFD for every maximal
+   // invalid subsequence. Both are checked in the same pass as the escaping
+   enum class utf8_handling { unchecked, validate, replace };
+
    struct options
    {
       int indentation = 4;
@@ -17,6 +51,7 @@ namespace cheap
       int initial_level = 0;
       bool escaping = true;
       bool end_with_newline = true;
+      utf8_handling utf8 = utf8_handling::unchecked;
    };
 
    struct cheap_exception final : std::runtime_error { using runtime_error::runtime_error; };
@@ -24,43 +59,707 @@ namespace cheap
    struct bool_attribute {
       std::string m_name;
       bool        m_value = true;
+      [[nodiscard]] auto operator==(const bool_attribute&) const -> bool = default;
    };
    struct string_attribute {
       std::string m_name;
       std::string m_value;
+      [[nodiscard]] auto operator==(const string_attribute&) const -> bool = default;
    };
    static_assert(std::is_aggregate_v<bool_attribute>);
    static_assert(std::is_aggregate_v<string_attribute>);
    using attribute = std::variant<bool_attribute, string_attribute>;
 
+   namespace detail
+   {
+      template<typename T, std::size_t capacity>
+      struct inline_storage
+      {
+         alignas(T) unsigned char m_bytes[capacity * sizeof(T)];
+         [[nodiscard]] auto get() -> T* { return reinterpret_cast<T*>(m_bytes); }
+         [[nodiscard]] auto get() const -> const T* { return reinterpret_cast<const T*>(m_bytes); }
+      };
+      template<typename T>
+      struct inline_storage<T, 0>
+      {
+         [[nodiscard]] auto get() const -> T* { return nullptr; }
+      };
+   } // namespace detail
+
+   // Vector that keeps up to inline_capacity values in place and only allocates beyond that
+   template<typename T, std::size_t inline_capacity>
+   struct small_vector
+   {
+      using value_type = T;
+      using iterator = T*;
+      using const_iterator = const T*;
+
+      small_vector() noexcept;
+      small_vector(std::initializer_list<T> values);
+      small_vector(const std::vector<T>& values);
+      small_vector(std::vector<T>&& values);
+      small_vector(const small_vector& other);
+      small_vector(small_vector&& other) noexcept(std::is_nothrow_move_constructible_v<T>);
+      auto operator=(const small_vector& other) -> small_vector&;
+      auto operator=(small_vector&& other) noexcept(std::is_nothrow_move_constructible_v<T>) -> small_vector&;
+      ~small_vector();
+
+      [[nodiscard]] auto begin() -> T* { return m_data; }
+      [[nodiscard]] auto end() -> T* { return m_data + m_size; }
+      [[nodiscard]] auto begin() const -> const T* { return m_data; }
+      [[nodiscard]] auto end() const -> const T* { return m_data + m_size; }
+      [[nodiscard]] auto data() -> T* { return m_data; }
+      [[nodiscard]] auto data() const -> const T* { return m_data; }
+      [[nodiscard]] auto size() const -> std::size_t { return m_size; }
+      [[nodiscard]] auto capacity() const -> std::size_t { return m_capacity; }
+      [[nodiscard]] auto empty() const -> bool { return m_size == 0; }
+      [[nodiscard]] auto is_inline() const -> bool { return m_data == get_inline(); }
+      [[nodiscard]] auto operator[](const std::size_t index) -> T& { return m_data[index]; }
+      [[nodiscard]] auto operator[](const std::size_t index) const -> const T& { return m_data[index]; }
+      [[nodiscard]] auto front() -> T& { return m_data[0]; }
+      [[nodiscard]] auto front() const -> const T& { return m_data[0]; }
+      [[nodiscard]] auto back() -> T& { return m_data[m_size - 1]; }
+      [[nodiscard]] auto back() const -> const T& { return m_data[m_size - 1]; }
+
+      auto reserve(const std::size_t capacity) -> void;
+      auto clear() -> void;
+      auto push_back(const T& value) -> void;
+      auto push_back(T&& value) -> void;
+      template<typename ... Ts>
+      auto emplace_back(Ts&&... args) -> T&;
+      auto pop_back() -> void;
+      [[nodiscard]] auto operator==(const small_vector& other) const -> bool;
+
+   private:
+      T* m_data;
+      std::size_t m_size = 0;
+      std::size_t m_capacity = inline_capacity;
+      [[no_unique_address]] detail::inline_storage<T, inline_capacity> m_inline;
+
+      [[nodiscard]] auto get_inline() -> T* { return m_inline.get(); }
+      [[nodiscard]] auto get_inline() const -> const T* { return m_inline.get(); }
+      auto reallocate(const std::size_t capacity) -> void;
+      auto assign(T* first, const std::size_t count, const bool is_move) -> void;
+   };
+
+   // Attributes of an element. With CHEAP_INLINE_ATTRIBUTES set, that many are stored in the element
+   // itself. That saves an allocation per element, but makes every element and content bigger. By
+   // default it's a plain std::vector
+#ifndef CHEAP_INLINE_ATTRIBUTES
+#define CHEAP_INLINE_ATTRIBUTES 0
+#endif
+#if CHEAP_INLINE_ATTRIBUTES == 0
+   using attribute_list = std::vector<attribute>;
+#else
+   using attribute_list = small_vector<attribute, CHEAP_INLINE_ATTRIBUTES>;
+#endif
+
+   // Content that is copied verbatim, even with escaping enabled. raw_html is trusted markup,
+   // escaped_text is text that was already escaped
+   struct raw_html {
+      std::string m_html;
+      [[nodiscard]] auto operator==(const raw_html&) const -> bool = default;
+   };
+   struct escaped_text {
+      std::string m_text;
+      [[nodiscard]] auto operator==(const escaped_text&) const -> bool = default;
+   };
+   // Text that is escaped like a std::string, but remembers the result. The first render stores the
+   // escaped form, or that none is needed, and later renders with the same options only copy it. Renders
+   // from several threads are fine, changes have to go through set()
+   struct text
+   {
+      explicit text(std::string str = {});
+      text(const text& other);
+      text(text&& other) noexcept;
+      auto operator=(const text& other) -> text&;
+      auto operator=(text&& other) noexcept -> text&;
+      [[nodiscard]] auto get() const -> const std::string& { return m_text; }
+      auto set(std::string str) -> void;
+      [[nodiscard]] auto operator==(const text& other) const -> bool { return m_text == other.m_text; }
+      // The key identifies the escape context and options the cached form was made with
+      [[nodiscard]] auto get_cached(const std::uint8_t key) const -> std::optional<std::string_view>;
+      auto set_cached(const std::uint8_t key, const std::string_view escaped, const std::size_t replacement_count) const -> void;
+      // Invalid UTF-8 sequences that were replaced in the cached form, which renders count again
+      [[nodiscard]] auto get_cached_replacement_count() const -> std::size_t { return m_replacement_count; }
+   private:
+      enum class cache_state : std::uint8_t { empty, writing, ready };
+      std::string m_text;
+      mutable std::atomic<cache_state> m_state = cache_state::empty;
+      mutable std::uint8_t m_key = 0;
+      mutable std::string m_escaped; // Empty if the text is written as it is
+      mutable std::size_t m_replacement_count = 0;
+      auto copy_cache(const text& other) -> void;
+      auto take_cache(text& other) -> void;
+   };
+
+   // Numbers and UTC timestamps are stored as they are and formatted with std::to_chars during rendering
+   using date_time = std::chrono::sys_seconds;
+
+   // Table that is rendered straight from its columns, without an element per cell. It only views
+   // the column data, which must outlive it. Column attributes are written on every cell of the column
+   using table_column = std::variant<std::span<const std::string>, std::span<const std::string_view>,
+      std::span<const int>, std::span<const long long>, std::span<const double>>;
+   struct column_table {
+      std::vector<std::string> m_header{};
+      std::vector<table_column> m_columns{};
+      std::vector<std::vector<attribute>> m_column_attributes{};
+      std::vector<attribute> m_attributes{};
+   };
+
+   // Content that is written by a function during rendering, with the same layout as an element tree.
+   // For big generated parts of a document that shouldn't be built as elements first
+   struct html_writer;
+   struct html_callback {
+      std::function<void(html_writer&)> m_write;
+   };
    struct element;
-   using content = std::variant<element, std::string>;
+   using content = std::variant<element, std::string, raw_html, escaped_text, text, long long, unsigned long long, double, date_time, column_table, html_callback>;
 
    struct element
    {
       std::string m_name;
-      std::vector<attribute> m_attributes;
+      attribute_list m_attributes;
       std::vector<content> m_inner_html;
       
       explicit element(const std::string_view name, std::vector<attribute> attributes, std::vector<content> inner_html);
       explicit element(const std::string_view name, std::vector<content> inner_html);
       explicit element(const std::string_view name);
+
+      // Defined in the implementation so they aren't inlined into every call site
+      element(const element& other);
+      element(element&& other) noexcept;
+      auto operator=(const element& other) -> element&;
+      auto operator=(element&& other) noexcept -> element&;
+      ~element();
+
+      [[nodiscard]] auto is_trivial() const -> bool;
+      [[nodiscard]] auto get_trivial(const options& opt) const -> std::string;
+      [[nodiscard]] auto is_self_closing() const -> bool;
+   };
+
+   // Non-owning counterparts of the attributes and element. They only view strings that must outlive them
+   struct bool_attribute_view {
+      std::string_view m_name;
+      bool             m_value = true;
+   };
+   struct string_attribute_view {
+      std::string_view m_name;
+      std::string_view m_value;
+   };
+   using attribute_view = std::variant<bool_attribute_view, string_attribute_view>;
+
+   struct element_view;
+   using content_view = std::variant<element_view, std::string_view>;
+
+#if !defined(CHEAP_CHECK_VIEWS) && !defined(NDEBUG)
+#define CHEAP_CHECK_VIEWS
+#endif
+
+   struct element_view
+   {
+      std::string_view m_name;
+      std::vector<attribute_view> m_attributes;
+      std::vector<content_view> m_inner_html;
+      // Identity and content hash of the viewed strings at construction. Only set with CHEAP_CHECK_VIEWS,
+      // but always there so the layout is the same in debug and release translation units
+      std::size_t m_debug_identity = 0;
+      std::size_t m_debug_checksum = 0;
+
+      explicit element_view(const std::string_view name, std::vector<attribute_view> attributes, std::vector<content_view> inner_html);
+      explicit element_view(const std::string_view name, std::vector<content_view> inner_html);
+      explicit element_view(const std::string_view name);
       [[nodiscard]] auto is_trivial() const -> bool;
       [[nodiscard]] auto get_trivial(const options& opt) const -> std::string;
       [[nodiscard]] auto is_self_closing() const -> bool;
+   };
+
+   // Stores every distinct string once, for element_view trees with many repeated attributes. The views
+   // it returns stay valid as long as the pool, and equal strings get the same view. A shared pool can
+   // be used from several threads
+   struct string_pool
+   {
+      explicit string_pool(const bool is_shared = false);
+      string_pool(const string_pool&) = delete;
+      auto operator=(const string_pool&) -> string_pool& = delete;
+
+      [[nodiscard]] auto intern(const std::string_view str) -> std::string_view;
+      // Same "name" or "name=value" syntax as the _att literal. Every distinct attribute is only validated once
+      [[nodiscard]] auto get_attribute(const std::string_view str) -> attribute_view;
+      [[nodiscard]] auto get_string_count() const -> std::size_t;
+      [[nodiscard]] auto get_byte_count() const -> std::size_t;
 
    private:
-      explicit element() = default;
-      template<typename ... Ts>
-      friend auto create_element(Ts&&... args) -> element;
+      struct pair_hash
+      {
+         auto operator()(const std::pair<const char*, const char*>& key) const -> std::size_t;
+      };
+      bool m_is_shared;
+      mutable std::mutex m_mutex;
+      std::unordered_set<std::string_view> m_strings;
+      std::unordered_set<std::pair<const char*, const char*>, pair_hash> m_valid_attributes;
+      std::vector<std::unique_ptr<char[]>> m_chunks;
+      char* m_chunk = nullptr;
+      std::size_t m_chunk_left = 0;
+      std::size_t m_byte_count = 0;
+      static constexpr std::size_t chunk_size = 64 * 1024;
+
+      [[nodiscard]] auto intern_locked(const std::string_view str) -> std::string_view;
    };
 
+   namespace detail
+   {
+      // Type-erased argument of the element functions. It only refers to the argument, which has
+      // to stay alive until the element is built. Rvalues are moved from.
+      struct element_param
+      {
+         enum class kind { element, attribute, bool_attribute, string_attribute, string, text, raw_html, escaped_text, cached_text, signed_number, unsigned_number, floating_number, date_time, column_table, html_callback };
+         kind m_kind;
+         const void* m_ptr = nullptr;
+         std::string_view m_text;
+         bool m_is_rvalue = false;
+         union
+         {
+            long long m_signed;
+            unsigned long long m_unsigned;
+            double m_floating;
+         };
+
+         element_param(const element& elem)            : m_kind(kind::element), m_ptr(&elem) {}
+         element_param(element&& elem)                 : m_kind(kind::element), m_ptr(&elem), m_is_rvalue(true) {}
+         element_param(const attribute& attrib)        : m_kind(kind::attribute), m_ptr(&attrib) {}
+         element_param(attribute&& attrib)             : m_kind(kind::attribute), m_ptr(&attrib), m_is_rvalue(true) {}
+         element_param(const bool_attribute& attrib)   : m_kind(kind::bool_attribute), m_ptr(&attrib) {}
+         element_param(bool_attribute&& attrib)        : m_kind(kind::bool_attribute), m_ptr(&attrib), m_is_rvalue(true) {}
+         element_param(const string_attribute& attrib) : m_kind(kind::string_attribute), m_ptr(&attrib) {}
+         element_param(string_attribute&& attrib)      : m_kind(kind::string_attribute), m_ptr(&attrib), m_is_rvalue(true) {}
+         element_param(const std::string& str)         : m_kind(kind::string), m_ptr(&str) {}
+         element_param(std::string&& str)              : m_kind(kind::string), m_ptr(&str), m_is_rvalue(true) {}
+         element_param(const std::string_view str)     : m_kind(kind::text), m_text(str) {}
+         element_param(const char* str)               : m_kind(kind::text), m_text(str) {}
+         element_param(const raw_html& html)           : m_kind(kind::raw_html), m_ptr(&html) {}
+         element_param(raw_html&& html)                : m_kind(kind::raw_html), m_ptr(&html), m_is_rvalue(true) {}
+         element_param(const escaped_text& text)       : m_kind(kind::escaped_text), m_ptr(&text) {}
+         element_param(escaped_text&& text)            : m_kind(kind::escaped_text), m_ptr(&text), m_is_rvalue(true) {}
+         element_param(const text& cached)             : m_kind(kind::cached_text), m_ptr(&cached) {}
+         element_param(text&& cached)                  : m_kind(kind::cached_text), m_ptr(&cached), m_is_rvalue(true) {}
+         element_param(const column_table& table)      : m_kind(kind::column_table), m_ptr(&table) {}
+         element_param(column_table&& table)           : m_kind(kind::column_table), m_ptr(&table), m_is_rvalue(true) {}
+         element_param(const html_callback& callback)  : m_kind(kind::html_callback), m_ptr(&callback) {}
+         element_param(html_callback&& callback)       : m_kind(kind::html_callback), m_ptr(&callback), m_is_rvalue(true) {}
+         element_param(const date_time time)           : m_kind(kind::date_time), m_signed(time.time_since_epoch().count()) {}
+         template<typename T> requires std::is_arithmetic_v<T>
+         element_param(const T number);
+      };
+
+      [[nodiscard]] auto make_element(const std::string_view name, std::initializer_list<element_param> params) -> element;
+
+      template<typename T>
+      concept number_like = std::is_arithmetic_v<T> && (std::same_as<T, bool> || std::same_as<T, char> || std::same_as<T, wchar_t>
+         || std::same_as<T, char8_t> || std::same_as<T, char16_t> || std::same_as<T, char32_t>) == false;
+
+      // Content alternative that stores a number
+      template<number_like T>
+      using number_content_t = std::conditional_t<std::is_floating_point_v<T>, double,
+         std::conditional_t<std::is_signed_v<T>, long long, unsigned long long>>;
+
+      // Floats become the double of their shortest representation, so they are written like floats
+      template<number_like T>
+      [[nodiscard]] auto to_number_content(const T number) -> number_content_t<T>;
+
+      // Shared by all element functions, so it's only instantiated once per argument types
+      template<typename ... Ts>
+      [[nodiscard]] auto make_element(const std::string_view name, Ts&&... args) -> element
+      {
+         return make_element(name, { element_param(std::forward<Ts>(args))... });
+      }
+   } // namespace detail
+
 
 
    [[nodiscard]] auto get_element_str(const element& elem,                           const options& opt = options{}) -> std::string;
    [[nodiscard]] auto get_element_str(const std::vector<element>& elements,          const options& opt = options{}) -> std::string;
    auto write_element_str(const element& elem,                  std::string& output, const options& opt = options{}) -> void;
    auto write_element_str(const std::vector<element>& elements, std::string& output, const options& opt = options{}) -> void;
+   [[nodiscard]] auto get_element_str(const element_view& elem,                      const options& opt = options{}) -> std::string;
+   auto write_element_str(const element_view& elem,             std::string& output, const options& opt = options{}) -> void;
+
+   // Byte ranges of a render, one node per content. Offsets are relative to the parent node
+   struct render_map
+   {
+      std::size_t m_offset = 0;
+      std::size_t m_length = 0;
+      std::vector<render_map> m_children;
+   };
+   using content_path = std::vector<std::size_t>;
+
+   [[nodiscard]] auto get_diff(const element& before, const element& after) -> std::vector<content_path>;
+   auto write_element_str(const element& elem, std::string& output, render_map& map, const options& opt = options{}) -> void;
+   auto rewrite_element_str(const element& after, const std::vector<content_path>& changes, std::string& output, render_map& map, const options& opt = options{}) -> void;
+
+   [[nodiscard]] auto get_patch_str(const element& before, const element& after, const options& opt = options{}) -> std::string;
+   auto write_patch_str(const element& before, const element& after, std::string& output, const options& opt = options{}) -> void;
+
+   // Output as a list of pieces, ready for writev. Generated markup is collected in m_buffer, while long
+   // texts that need no escaping and verbatim content are referenced in place. The rendered element has
+   // to outlive the segments
+   struct scatter_output
+   {
+      struct segment
+      {
+         const char* m_external = nullptr; // nullptr for pieces of m_buffer
+         std::size_t m_offset = 0;
+         std::size_t m_length = 0;
+      };
+      std::string m_buffer;
+      std::vector<segment> m_segments;
+      std::size_t m_buffer_end = 0; // End of the last buffer piece in m_segments
+      std::size_t m_reference_threshold = 256;
+
+      auto clear() -> void;
+      auto append_reference(const std::string_view str) -> void;
+      [[nodiscard]] auto get_segments() const -> std::vector<std::string_view>;
+      [[nodiscard]] auto size() const -> std::size_t;
+#ifdef CHEAP_HAS_IOVEC
+      // Can hold more than IOV_MAX entries. write_to() splits them up and continues after short writes
+      [[nodiscard]] auto get_iovecs() const -> std::vector<iovec>;
+      auto write_to(const int file_descriptor) const -> void; // Blocking descriptors, like files and sockets
+#endif
+   };
+   auto write_element_scatter(const element& elem,      scatter_output& output, const options& opt = options{}) -> void;
+   auto write_element_scatter(const element_view& elem, scatter_output& output, const options& opt = options{}) -> void;
+
+   // Receives the output in chunks while rendering, so the whole document is never held in memory
+   struct output_stream
+   {
+      virtual ~output_stream() = default;
+      virtual auto write(const std::string_view chunk) -> void = 0;
+   };
+   auto write_element_stream(const element& elem,      output_stream& stream, const options& opt = options{}) -> void;
+   auto write_element_stream(const element_view& elem, output_stream& stream, const options& opt = options{}) -> void;
+
+   // Renders into a memory-mapped file of the exact size, or with buffered writes where mapping fails
+   auto write_element_file(const std::string& path, const element& elem, const options& opt = options{}) -> void;
+
+   // Rendering state that is created once, e.g. per thread, and reused for many renders with the same
+   // options. Steady-state renders into a reused string or a stream don't allocate
+   struct render_context
+   {
+      struct statistics
+      {
+         std::size_t m_render_count = 0;
+         std::size_t m_byte_count = 0;
+         std::size_t m_peak_size = 0;  // Largest output so far, string outputs are reserved to this
+         std::size_t m_utf8_replacement_count = 0; // With utf8_handling::replace
+      };
+      options m_options;
+      std::string m_stream_buffer;     // Chunk buffer of stream renders
+      statistics m_statistics{};
+
+      explicit render_context(const options& opt = options{});
+      auto render(const element& elem,      std::string& output) -> void;
+      auto render(const element_view& elem, std::string& output) -> void;
+      auto render(const element& elem,      output_stream& stream) -> void;
+      auto render(const element_view& elem, output_stream& stream) -> void;
+   };
+
+   // Names a kind of page, like "article". Per thread, string outputs of renders with the same key are
+   // reserved to a moving high-water mark of their sizes, so the output rarely has to grow while rendering
+   struct template_key
+   {
+      explicit template_key(const std::string_view name) : m_name(name) {}
+      std::string_view m_name;
+   };
+   struct reservation_statistics
+   {
+      std::size_t m_render_count = 0;
+      std::size_t m_regrowth_count = 0; // Renders that outgrew the reserved size
+      std::size_t m_reserved_size = 0;  // For the next render
+   };
+   [[nodiscard]] auto get_element_str(const element& elem,      const template_key key, const options& opt = options{}) -> std::string;
+   [[nodiscard]] auto get_element_str(const element_view& elem, const template_key key, const options& opt = options{}) -> std::string;
+   auto write_element_str(const element& elem,      std::string& output, const template_key key, const options& opt = options{}) -> void;
+   auto write_element_str(const element_view& elem, std::string& output, const template_key key, const options& opt = options{}) -> void;
+   [[nodiscard]] auto get_reservation_statistics(const template_key key) -> reservation_statistics; // Of the calling thread
+
+   // Renders into an output iterator, like the ones of std::format_to and fmt::format_to. The output is
+   // passed on in chunks from a buffer that is reused per thread, without a string of the whole element
+   template<std::output_iterator<char> iterator_type>
+   auto write_element_to(const element& elem,      iterator_type out, const options& opt = options{}) -> iterator_type;
+   template<std::output_iterator<char> iterator_type>
+   auto write_element_to(const element_view& elem, iterator_type out, const options& opt = options{}) -> iterator_type;
+#ifdef CHEAP_USE_FMT
+   template<std::size_t size>
+   auto write_element_fmt(const element& elem, fmt::basic_memory_buffer<char, size>& buffer, const options& opt = options{}) -> void;
+#endif
+
+   namespace detail
+   {
+      struct stream_output;
+      enum class escape_context;
+   } // namespace detail
+
+   // Writes HTML straight to the output while a document is generated, without building a tree. Only
+   // the open elements are kept, so memory doesn't grow with the document. The output is the same as
+   // for the equivalent element tree. finish() closes the open elements and has to be called at the end
+   struct html_writer
+   {
+      explicit html_writer(std::string& output, const options& opt = options{}); // Appends to the output
+      explicit html_writer(output_stream& stream, const options& opt = options{});
+      // For callbacks, with the context of the element they are in
+      explicit html_writer(std::string& output, const options& opt, const detail::escape_context root_context);
+      explicit html_writer(detail::stream_output& output, const options& opt, const detail::escape_context root_context);
+      html_writer(const html_writer&) = delete;
+      auto operator=(const html_writer&) -> html_writer& = delete;
+      ~html_writer();
+
+      auto open(const std::string_view name) -> html_writer&;
+      // Attributes have to follow open() and are validated like the ones of elements
+      auto attr(const std::string_view name) -> html_writer&;
+      auto attr(const std::string_view name, const std::string_view value) -> html_writer&;
+      auto attr(const attribute& attrib) -> html_writer&;
+      auto text(const std::string_view str) -> html_writer&;
+      auto text(const raw_html& html) -> html_writer&;
+      auto text(const escaped_text& escaped) -> html_writer&;
+      auto text(const date_time time) -> html_writer&;
+      template<detail::number_like T>
+      auto text(const T number) -> html_writer&;
+      auto close() -> html_writer&;
+      auto finish() -> void;
+      [[nodiscard]] auto get_depth() const -> std::size_t;
+
+   private:
+      struct open_element
+      {
+         std::string m_name;
+         std::size_t m_child_count = 0;
+         bool m_is_start_tag_open = true;
+         bool m_is_self_closing = false;
+      };
+      options m_options;
+      std::unique_ptr<detail::stream_output> m_own_stream;
+      detail::stream_output* m_stream = nullptr;
+      std::string& m_output;
+      std::vector<open_element> m_open_elements;
+      detail::escape_context m_root_context;
+      std::size_t m_root_count = 0;
+      // Start of the first child of the innermost element while that is a text. It's moved to its own
+      // line when more children follow, so nothing is flushed until then
+      std::size_t m_first_text = std::string::npos;
+      auto begin_child(const bool is_text) -> void;
+      auto flush_if_full() -> void;
+   };
+
+   // Renders many independent documents in parallel. The factory creates the output of a document
+   // and is called from the worker threads
+   using batch_output_factory = std::function<std::unique_ptr<output_stream>(const std::size_t index)>;
+   struct batch_statistics
+   {
+      std::size_t m_document_count = 0;
+      std::size_t m_byte_count = 0;
+      std::size_t m_steal_count = 0;    // How often a worker took over work from another one
+      std::size_t m_utf8_replacement_count = 0;
+      unsigned m_thread_count = 0;
+      std::chrono::duration<double> m_duration{};
+      [[nodiscard]] auto get_bytes_per_second() const -> double;
+   };
+   // A thread count of 0 uses all hardware threads
+   auto render_batch(const std::span<const element> documents, const options& opt, const batch_output_factory& factory, unsigned thread_count = 0) -> batch_statistics;
+
+   // Compresses everything written to it in the gzip (RFC 1952) or zlib (RFC 1950) format before
+   // passing it on to the target, which can be placed between the renderer and any output_stream.
+   // Level 0 only stores, 1 to 9 trade speed for size like in zlib. finish() writes the end of the
+   // compressed data and has to be called after the last write
+   enum class compression_format { gzip, zlib };
+   struct compress_stream final : output_stream
+   {
+      struct lz_symbol
+      {
+         std::uint16_t m_literal_or_length;
+         std::uint16_t m_distance; // 0 for literals
+      };
+
+      output_stream& m_target;
+      compression_format m_format;
+      int m_max_chain;
+      std::size_t m_nice_length;
+      bool m_lazy;
+      std::string m_input;         // The window of previous input, followed by pending input
+      std::size_t m_pending = 0;   // Start of the pending input in m_input
+      std::uint64_t m_input_base = 0; // Position of m_input[0] in the whole input
+      std::vector<std::uint64_t> m_hash_heads;
+      std::vector<std::uint64_t> m_hash_chains;
+      std::vector<lz_symbol> m_symbols;
+      std::string m_output;
+      std::uint64_t m_bit_buffer = 0;
+      int m_bit_count = 0;
+      std::uint32_t m_checksum;
+      std::uint32_t m_input_size = 0;
+      bool m_is_finished = false;
+
+      explicit compress_stream(output_stream& target, const int level = 6, const compression_format format = compression_format::gzip);
+      ~compress_stream(); // Debug builds assert that finish() was called, unless an exception is on its way
+      auto write(const std::string_view chunk) -> void override;
+      auto finish() -> void;
+
+   private:
+      auto compress_block(const std::size_t end, const bool is_final) -> void;
+      [[nodiscard]] auto find_match(const std::size_t position, const std::size_t end) const -> lz_symbol;
+      auto insert_hash(const std::size_t position) -> void;
+      auto write_bits(const std::uint32_t bits, const int count) -> void;
+      auto align_bits() -> void;
+      auto write_stored_block(const std::size_t end, const bool is_final) -> void;
+      auto write_symbols(std::span<const std::uint8_t> lengths, std::span<const std::uint16_t> codes, std::span<const std::uint8_t> distance_lengths, std::span<const std::uint16_t> distance_codes) -> void;
+   };
+
+   // Incremental hashes for the rendered output. XXH64 is fast and suited for ETags, SHA-256 is
+   // for when collisions must be ruled out
+   struct xxh64_hasher
+   {
+      std::uint64_t m_accumulators[4] = { 0x9E3779B185EBCA87ull + 0xC2B2AE3D27D4EB4Full, 0xC2B2AE3D27D4EB4Full, 0, 0 - 0x9E3779B185EBCA87ull };
+      unsigned char m_block[32]{};
+      std::size_t m_block_size = 0;
+      std::uint64_t m_total_size = 0;
+
+      auto update(const std::string_view data) -> void;
+      [[nodiscard]] auto get_digest() const -> std::uint64_t;
+   };
+   struct sha256_hasher
+   {
+      std::uint32_t m_state[8] = { 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 };
+      unsigned char m_block[64]{};
+      std::size_t m_block_size = 0;
+      std::uint64_t m_total_size = 0;
+
+      auto update(const std::string_view data) -> void;
+      [[nodiscard]] auto get_digest() const -> std::array<std::uint8_t, 32>;
+   };
+   struct content_hash
+   {
+      std::uint64_t m_xxh64 = 0;
+      std::optional<std::array<std::uint8_t, 32>> m_sha256{};
+
+      // Strong ETag with the quotes, e.g. "0123456789abcdef"
+      [[nodiscard]] auto get_etag() const -> std::string;
+   };
+
+   // Hashes everything written to it and passes it on to the target, if there is one
+   struct hash_stream final : output_stream
+   {
+      output_stream* m_target;
+      bool m_with_sha256;
+      xxh64_hasher m_xxh64;
+      sha256_hasher m_sha256;
+
+      explicit hash_stream(output_stream* target = nullptr, const bool with_sha256 = false);
+      auto write(const std::string_view chunk) -> void override;
+      [[nodiscard]] auto get_hash() const -> content_hash;
+   };
+   // Each chunk is hashed right after it's rendered, while it's still in the cache
+   auto write_element_str(const element& elem, std::string& output, content_hash& hash, const options& opt = options{}, const bool with_sha256 = false) -> void;
+
+   // Binary snapshot of an element tree. The layout (little-endian) is a header, the node records,
+   // the attribute records and the string bytes. Nodes are stored breadth-first so the children of a
+   // node are consecutive, node 0 is the root. Reading only maps the file and renders straight from
+   // the records, so opening doesn't depend on the size
+   struct snapshot
+   {
+      struct header
+      {
+         char m_magic[8];            // "CHEAPSNP"
+         std::uint32_t m_version;    // 1
+         std::uint32_t m_node_count;
+         std::uint32_t m_attribute_count;
+         std::uint32_t m_reserved;
+         std::uint64_t m_nodes_offset;
+         std::uint64_t m_attributes_offset;
+         std::uint64_t m_strings_offset;
+         std::uint64_t m_strings_size;
+      };
+      // Verbatim text is written as it is, text is escaped. Numbers and dates are stored formatted
+      enum class node_kind : std::uint8_t { element, text, verbatim };
+      struct node
+      {
+         std::uint64_t m_string_offset; // The name of elements, otherwise the text
+         std::uint32_t m_string_length;
+         node_kind m_kind;
+         std::uint8_t m_reserved[3];
+         std::uint32_t m_first_attribute;
+         std::uint32_t m_attribute_count;
+         std::uint32_t m_first_child;
+         std::uint32_t m_child_count;
+      };
+      enum class attribute_kind : std::uint8_t { bool_false, bool_true, string };
+      struct attribute_record
+      {
+         std::uint64_t m_name_offset;
+         std::uint64_t m_value_offset;
+         std::uint32_t m_name_length;
+         std::uint32_t m_value_length;
+         attribute_kind m_kind;
+         std::uint8_t m_reserved[7];
+      };
+
+      std::string_view m_data;
+      header m_header{};
+      std::string m_owned;        // File contents when it couldn't be mapped
+      void* m_mapping = nullptr;  // Set when a file is mapped
+
+      explicit snapshot(const std::string_view data);
+      [[nodiscard]] static auto open_file(const std::string& path) -> snapshot;
+      snapshot(snapshot&& other) noexcept;
+      auto operator=(snapshot&& other) noexcept -> snapshot&;
+      snapshot(const snapshot&) = delete;
+      auto operator=(const snapshot&) -> snapshot& = delete;
+      ~snapshot();
+
+      [[nodiscard]] auto get_node(const std::uint32_t index) const -> node;
+      [[nodiscard]] auto get_attribute(const std::uint32_t index) const -> attribute_record;
+      [[nodiscard]] auto get_string(const std::uint64_t offset, const std::uint32_t length) const -> std::string_view;
+   };
+   static_assert(sizeof(snapshot::header) == 56 && sizeof(snapshot::node) == 32 && sizeof(snapshot::attribute_record) == 32);
+
+   [[nodiscard]] auto get_snapshot(const element& elem) -> std::string;
+   [[nodiscard]] auto get_snapshot_str(const snapshot& snap, const options& opt = options{}) -> std::string;
+   auto write_snapshot_str(const snapshot& snap, std::string& output, const options& opt = options{}) -> void;
+   auto write_snapshot_stream(const snapshot& snap, output_stream& stream, const options& opt = options{}) -> void;
+
+   // Parses a fragment of HTML into elements: tags, attributes, text, void elements and character references.
+   // Whitespace around texts is dropped, since the output is indented anew. Comments and declarations are
+   // skipped, script and style contents are kept as raw_html. Malformed markup throws
+   [[nodiscard]] auto parse_html(const std::string_view html) -> std::vector<element>;
+
+   // Compile-time documents for fully static markup
+   template<std::size_t N>
+   struct fixed_string
+   {
+      char m_data[N]{};
+      constexpr fixed_string() = default;
+      constexpr fixed_string(const char (&str)[N]);
+      [[nodiscard]] constexpr auto view() const -> std::string_view;
+   };
+
+   struct static_attribute
+   {
+      std::string_view m_name;
+      std::string_view m_value;
+      bool m_is_bool = true;
+
+      // Same syntax as the _att literal: "name" or "name=value"
+      constexpr explicit static_attribute(const std::string_view str);
+   };
+
+   template<fixed_string name, typename ... Ts>
+   struct static_element
+   {
+      std::tuple<Ts...> m_contents;
+   };
+
+   template<fixed_string name, typename ... Ts>
+   [[nodiscard]] constexpr auto make_static(Ts... args);
+
+   template<options opt = options{}, typename builder_type>
+   [[nodiscard]] consteval auto render_static(builder_type builder);
 
    inline namespace literals
    {
@@ -70,118 +769,253 @@ namespace cheap
    template<typename ... Ts>
    [[nodiscard]] auto create_element(Ts&&... args) -> element;
    
-   template<typename ... Ts> auto a         (Ts&&... args) -> element { return create_element("a",          std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto abbr      (Ts&&... args) -> element { return create_element("abbr",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto address   (Ts&&... args) -> element { return create_element("address",    std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto area      (Ts&&... args) -> element { return create_element("area",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto article   (Ts&&... args) -> element { return create_element("article",    std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto aside     (Ts&&... args) -> element { return create_element("aside",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto audio     (Ts&&... args) -> element { return create_element("audio",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto b         (Ts&&... args) -> element { return create_element("b",          std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto base      (Ts&&... args) -> element { return create_element("base",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto bdi       (Ts&&... args) -> element { return create_element("bdi",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto bdo       (Ts&&... args) -> element { return create_element("bdo",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto blockquote(Ts&&... args) -> element { return create_element("blockquote", std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto body      (Ts&&... args) -> element { return create_element("body",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto br        (Ts&&... args) -> element { return create_element("br",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto button    (Ts&&... args) -> element { return create_element("button",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto canvas    (Ts&&... args) -> element { return create_element("canvas",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto caption   (Ts&&... args) -> element { return create_element("caption",    std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto cite      (Ts&&... args) -> element { return create_element("cite",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto code      (Ts&&... args) -> element { return create_element("code",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto col       (Ts&&... args) -> element { return create_element("col",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto colgroup  (Ts&&... args) -> element { return create_element("colgroup",   std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto data      (Ts&&... args) -> element { return create_element("data",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto datalist  (Ts&&... args) -> element { return create_element("datalist",   std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto dd        (Ts&&... args) -> element { return create_element("dd",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto del       (Ts&&... args) -> element { return create_element("del",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto details   (Ts&&... args) -> element { return create_element("details",    std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto dfn       (Ts&&... args) -> element { return create_element("dfn",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto dialog    (Ts&&... args) -> element { return create_element("dialog",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto div       (Ts&&... args) -> element { return create_element("div",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto dl        (Ts&&... args) -> element { return create_element("dl",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto dt        (Ts&&... args) -> element { return create_element("dt",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto em        (Ts&&... args) -> element { return create_element("em",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto embed     (Ts&&... args) -> element { return create_element("embed",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto fieldset  (Ts&&... args) -> element { return create_element("fieldset",   std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto figcaption(Ts&&... args) -> element { return create_element("figcaption", std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto figure    (Ts&&... args) -> element { return create_element("figure",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto footer    (Ts&&... args) -> element { return create_element("footer",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto form      (Ts&&... args) -> element { return create_element("form",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto h1        (Ts&&... args) -> element { return create_element("h1",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto h2        (Ts&&... args) -> element { return create_element("h2",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto h3        (Ts&&... args) -> element { return create_element("h3",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto h4        (Ts&&... args) -> element { return create_element("h4",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto h5        (Ts&&... args) -> element { return create_element("h5",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto h6        (Ts&&... args) -> element { return create_element("h6",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto head      (Ts&&... args) -> element { return create_element("head",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto header    (Ts&&... args) -> element { return create_element("header",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto hr        (Ts&&... args) -> element { return create_element("hr",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto html      (Ts&&... args) -> element { return create_element("html",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto i         (Ts&&... args) -> element { return create_element("i",          std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto iframe    (Ts&&... args) -> element { return create_element("iframe",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto img       (Ts&&... args) -> element { return create_element("img",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto input     (Ts&&... args) -> element { return create_element("input",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto ins       (Ts&&... args) -> element { return create_element("ins",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto kdb       (Ts&&... args) -> element { return create_element("kdb",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto label     (Ts&&... args) -> element { return create_element("label",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto legend    (Ts&&... args) -> element { return create_element("legend",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto li        (Ts&&... args) -> element { return create_element("li",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto link      (Ts&&... args) -> element { return create_element("link",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto main      (Ts&&... args) -> element { return create_element("main",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto map       (Ts&&... args) -> element { return create_element("map",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto mark      (Ts&&... args) -> element { return create_element("mark",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto math      (Ts&&... args) -> element { return create_element("math",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto menu      (Ts&&... args) -> element { return create_element("menu",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto meta      (Ts&&... args) -> element { return create_element("meta",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto meter     (Ts&&... args) -> element { return create_element("meter",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto nav       (Ts&&... args) -> element { return create_element("nav",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto noscript  (Ts&&... args) -> element { return create_element("noscript",   std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto object    (Ts&&... args) -> element { return create_element("object",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto ol        (Ts&&... args) -> element { return create_element("ol",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto optgroup  (Ts&&... args) -> element { return create_element("optgroup",   std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto option    (Ts&&... args) -> element { return create_element("option",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto p         (Ts&&... args) -> element { return create_element("p",          std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto picture   (Ts&&... args) -> element { return create_element("picture",    std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto portal    (Ts&&... args) -> element { return create_element("portal",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto pre       (Ts&&... args) -> element { return create_element("pre",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto progress  (Ts&&... args) -> element { return create_element("progress",   std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto q         (Ts&&... args) -> element { return create_element("q",          std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto rp        (Ts&&... args) -> element { return create_element("rp",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto rt        (Ts&&... args) -> element { return create_element("rt",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto ruby      (Ts&&... args) -> element { return create_element("ruby",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto s         (Ts&&... args) -> element { return create_element("s",          std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto samp      (Ts&&... args) -> element { return create_element("samp",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto script    (Ts&&... args) -> element { return create_element("script",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto section   (Ts&&... args) -> element { return create_element("section",    std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto select    (Ts&&... args) -> element { return create_element("select",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto slot      (Ts&&... args) -> element { return create_element("slot",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto small_    (Ts&&... args) -> element { return create_element("small",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto source    (Ts&&... args) -> element { return create_element("source",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto span      (Ts&&... args) -> element { return create_element("span",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto stable    (Ts&&... args) -> element { return create_element("stable",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto strong    (Ts&&... args) -> element { return create_element("strong",     std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto style     (Ts&&... args) -> element { return create_element("style",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto sub       (Ts&&... args) -> element { return create_element("sub",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto summary   (Ts&&... args) -> element { return create_element("summary",    std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto sup       (Ts&&... args) -> element { return create_element("sup",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto svg       (Ts&&... args) -> element { return create_element("svg",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto tbody     (Ts&&... args) -> element { return create_element("tbody",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto td        (Ts&&... args) -> element { return create_element("td",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto template_ (Ts&&... args) -> element { return create_element("template",   std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto textarea  (Ts&&... args) -> element { return create_element("textarea",   std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto tfoot     (Ts&&... args) -> element { return create_element("tfoot",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto th        (Ts&&... args) -> element { return create_element("th",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto thead     (Ts&&... args) -> element { return create_element("thead",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto time      (Ts&&... args) -> element { return create_element("time",       std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto title     (Ts&&... args) -> element { return create_element("title",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto tr        (Ts&&... args) -> element { return create_element("tr",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto track     (Ts&&... args) -> element { return create_element("track",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto u         (Ts&&... args) -> element { return create_element("u",          std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto ul        (Ts&&... args) -> element { return create_element("ul",         std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto var       (Ts&&... args) -> element { return create_element("var",        std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto video     (Ts&&... args) -> element { return create_element("video",      std::forward<Ts>(args)...); }
-   template<typename ... Ts> auto wbr       (Ts&&... args) -> element { return create_element("wbr",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto a         (Ts&&... args) -> element { return detail::make_element("a",          std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto abbr      (Ts&&... args) -> element { return detail::make_element("abbr",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto address   (Ts&&... args) -> element { return detail::make_element("address",    std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto area      (Ts&&... args) -> element { return detail::make_element("area",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto article   (Ts&&... args) -> element { return detail::make_element("article",    std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto aside     (Ts&&... args) -> element { return detail::make_element("aside",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto audio     (Ts&&... args) -> element { return detail::make_element("audio",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto b         (Ts&&... args) -> element { return detail::make_element("b",          std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto base      (Ts&&... args) -> element { return detail::make_element("base",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto bdi       (Ts&&... args) -> element { return detail::make_element("bdi",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto bdo       (Ts&&... args) -> element { return detail::make_element("bdo",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto blockquote(Ts&&... args) -> element { return detail::make_element("blockquote", std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto body      (Ts&&... args) -> element { return detail::make_element("body",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto br        (Ts&&... args) -> element { return detail::make_element("br",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto button    (Ts&&... args) -> element { return detail::make_element("button",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto canvas    (Ts&&... args) -> element { return detail::make_element("canvas",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto caption   (Ts&&... args) -> element { return detail::make_element("caption",    std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto cite      (Ts&&... args) -> element { return detail::make_element("cite",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto code      (Ts&&... args) -> element { return detail::make_element("code",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto col       (Ts&&... args) -> element { return detail::make_element("col",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto colgroup  (Ts&&... args) -> element { return detail::make_element("colgroup",   std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto data      (Ts&&... args) -> element { return detail::make_element("data",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto datalist  (Ts&&... args) -> element { return detail::make_element("datalist",   std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto dd        (Ts&&... args) -> element { return detail::make_element("dd",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto del       (Ts&&... args) -> element { return detail::make_element("del",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto details   (Ts&&... args) -> element { return detail::make_element("details",    std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto dfn       (Ts&&... args) -> element { return detail::make_element("dfn",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto dialog    (Ts&&... args) -> element { return detail::make_element("dialog",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto div       (Ts&&... args) -> element { return detail::make_element("div",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto dl        (Ts&&... args) -> element { return detail::make_element("dl",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto dt        (Ts&&... args) -> element { return detail::make_element("dt",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto em        (Ts&&... args) -> element { return detail::make_element("em",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto embed     (Ts&&... args) -> element { return detail::make_element("embed",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto fieldset  (Ts&&... args) -> element { return detail::make_element("fieldset",   std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto figcaption(Ts&&... args) -> element { return detail::make_element("figcaption", std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto figure    (Ts&&... args) -> element { return detail::make_element("figure",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto footer    (Ts&&... args) -> element { return detail::make_element("footer",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto form      (Ts&&... args) -> element { return detail::make_element("form",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto h1        (Ts&&... args) -> element { return detail::make_element("h1",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto h2        (Ts&&... args) -> element { return detail::make_element("h2",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto h3        (Ts&&... args) -> element { return detail::make_element("h3",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto h4        (Ts&&... args) -> element { return detail::make_element("h4",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto h5        (Ts&&... args) -> element { return detail::make_element("h5",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto h6        (Ts&&... args) -> element { return detail::make_element("h6",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto head      (Ts&&... args) -> element { return detail::make_element("head",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto header    (Ts&&... args) -> element { return detail::make_element("header",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto hr        (Ts&&... args) -> element { return detail::make_element("hr",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto html      (Ts&&... args) -> element { return detail::make_element("html",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto i         (Ts&&... args) -> element { return detail::make_element("i",          std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto iframe    (Ts&&... args) -> element { return detail::make_element("iframe",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto img       (Ts&&... args) -> element { return detail::make_element("img",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto input     (Ts&&... args) -> element { return detail::make_element("input",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto ins       (Ts&&... args) -> element { return detail::make_element("ins",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto kdb       (Ts&&... args) -> element { return detail::make_element("kdb",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto label     (Ts&&... args) -> element { return detail::make_element("label",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto legend    (Ts&&... args) -> element { return detail::make_element("legend",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto li        (Ts&&... args) -> element { return detail::make_element("li",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto link      (Ts&&... args) -> element { return detail::make_element("link",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto main      (Ts&&... args) -> element { return detail::make_element("main",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto map       (Ts&&... args) -> element { return detail::make_element("map",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto mark      (Ts&&... args) -> element { return detail::make_element("mark",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto math      (Ts&&... args) -> element { return detail::make_element("math",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto menu      (Ts&&... args) -> element { return detail::make_element("menu",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto meta      (Ts&&... args) -> element { return detail::make_element("meta",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto meter     (Ts&&... args) -> element { return detail::make_element("meter",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto nav       (Ts&&... args) -> element { return detail::make_element("nav",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto noscript  (Ts&&... args) -> element { return detail::make_element("noscript",   std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto object    (Ts&&... args) -> element { return detail::make_element("object",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto ol        (Ts&&... args) -> element { return detail::make_element("ol",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto optgroup  (Ts&&... args) -> element { return detail::make_element("optgroup",   std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto option    (Ts&&... args) -> element { return detail::make_element("option",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto p         (Ts&&... args) -> element { return detail::make_element("p",          std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto picture   (Ts&&... args) -> element { return detail::make_element("picture",    std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto portal    (Ts&&... args) -> element { return detail::make_element("portal",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto pre       (Ts&&... args) -> element { return detail::make_element("pre",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto progress  (Ts&&... args) -> element { return detail::make_element("progress",   std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto q         (Ts&&... args) -> element { return detail::make_element("q",          std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto rp        (Ts&&... args) -> element { return detail::make_element("rp",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto rt        (Ts&&... args) -> element { return detail::make_element("rt",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto ruby      (Ts&&... args) -> element { return detail::make_element("ruby",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto s         (Ts&&... args) -> element { return detail::make_element("s",          std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto samp      (Ts&&... args) -> element { return detail::make_element("samp",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto script    (Ts&&... args) -> element { return detail::make_element("script",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto section   (Ts&&... args) -> element { return detail::make_element("section",    std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto select    (Ts&&... args) -> element { return detail::make_element("select",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto slot      (Ts&&... args) -> element { return detail::make_element("slot",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto small_    (Ts&&... args) -> element { return detail::make_element("small",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto source    (Ts&&... args) -> element { return detail::make_element("source",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto span      (Ts&&... args) -> element { return detail::make_element("span",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto stable    (Ts&&... args) -> element { return detail::make_element("stable",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto strong    (Ts&&... args) -> element { return detail::make_element("strong",     std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto style     (Ts&&... args) -> element { return detail::make_element("style",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto sub       (Ts&&... args) -> element { return detail::make_element("sub",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto summary   (Ts&&... args) -> element { return detail::make_element("summary",    std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto sup       (Ts&&... args) -> element { return detail::make_element("sup",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto svg       (Ts&&... args) -> element { return detail::make_element("svg",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto tbody     (Ts&&... args) -> element { return detail::make_element("tbody",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto td        (Ts&&... args) -> element { return detail::make_element("td",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto template_ (Ts&&... args) -> element { return detail::make_element("template",   std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto textarea  (Ts&&... args) -> element { return detail::make_element("textarea",   std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto tfoot     (Ts&&... args) -> element { return detail::make_element("tfoot",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto th        (Ts&&... args) -> element { return detail::make_element("th",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto thead     (Ts&&... args) -> element { return detail::make_element("thead",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto time      (Ts&&... args) -> element { return detail::make_element("time",       std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto title     (Ts&&... args) -> element { return detail::make_element("title",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto tr        (Ts&&... args) -> element { return detail::make_element("tr",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto track     (Ts&&... args) -> element { return detail::make_element("track",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto u         (Ts&&... args) -> element { return detail::make_element("u",          std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto ul        (Ts&&... args) -> element { return detail::make_element("ul",         std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto var       (Ts&&... args) -> element { return detail::make_element("var",        std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto video     (Ts&&... args) -> element { return detail::make_element("video",      std::forward<Ts>(args)...); }
+   template<typename ... Ts> auto wbr       (Ts&&... args) -> element { return detail::make_element("wbr",        std::forward<Ts>(args)...); }
+
+   template<typename T>
+   concept output_sink = requires(T& sink, const char* str) { sink.append(str, str); };
+
+   // Element that only captures its arguments. Lvalue arguments are captured by reference
+   template<typename ... Ts>
+   struct expr_element
+   {
+      std::string_view m_name;
+      std::tuple<Ts...> m_args;
+
+      template<output_sink sink_type>
+      auto render_to(sink_type& sink, const options& opt = options{}) const -> void;
+      [[nodiscard]] auto to_element() const -> element;
+      explicit operator element() const { return to_element(); }
+   };
+
+   namespace expr
+   {
+      template<typename ... Ts>
+      [[nodiscard]] auto create_element(const std::string_view name, Ts&&... args) -> expr_element<Ts...>;
+
+      template<typename ... Ts> auto a         (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("a",          std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto abbr      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("abbr",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto address   (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("address",    std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto area      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("area",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto article   (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("article",    std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto aside     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("aside",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto audio     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("audio",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto b         (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("b",          std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto base      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("base",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto bdi       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("bdi",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto bdo       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("bdo",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto blockquote(Ts&&... args) -> expr_element<Ts...> { return expr::create_element("blockquote", std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto body      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("body",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto br        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("br",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto button    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("button",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto canvas    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("canvas",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto caption   (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("caption",    std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto cite      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("cite",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto code      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("code",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto col       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("col",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto colgroup  (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("colgroup",   std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto data      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("data",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto datalist  (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("datalist",   std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto dd        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("dd",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto del       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("del",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto details   (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("details",    std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto dfn       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("dfn",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto dialog    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("dialog",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto div       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("div",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto dl        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("dl",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto dt        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("dt",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto em        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("em",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto embed     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("embed",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto fieldset  (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("fieldset",   std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto figcaption(Ts&&... args) -> expr_element<Ts...> { return expr::create_element("figcaption", std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto figure    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("figure",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto footer    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("footer",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto form      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("form",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto h1        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("h1",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto h2        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("h2",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto h3        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("h3",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto h4        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("h4",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto h5        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("h5",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto h6        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("h6",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto head      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("head",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto header    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("header",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto hr        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("hr",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto html      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("html",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto i         (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("i",          std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto iframe    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("iframe",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto img       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("img",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto input     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("input",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto ins       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("ins",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto kdb       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("kdb",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto label     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("label",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto legend    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("legend",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto li        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("li",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto link      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("link",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto main      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("main",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto map       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("map",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto mark      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("mark",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto math      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("math",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto menu      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("menu",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto meta      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("meta",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto meter     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("meter",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto nav       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("nav",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto noscript  (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("noscript",   std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto object    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("object",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto ol        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("ol",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto optgroup  (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("optgroup",   std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto option    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("option",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto p         (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("p",          std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto picture   (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("picture",    std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto portal    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("portal",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto pre       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("pre",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto progress  (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("progress",   std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto q         (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("q",          std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto rp        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("rp",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto rt        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("rt",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto ruby      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("ruby",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto s         (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("s",          std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto samp      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("samp",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto script    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("script",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto section   (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("section",    std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto select    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("select",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto slot      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("slot",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto small_    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("small",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto source    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("source",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto span      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("span",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto stable    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("stable",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto strong    (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("strong",     std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto style     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("style",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto sub       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("sub",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto summary   (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("summary",    std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto sup       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("sup",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto svg       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("svg",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto tbody     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("tbody",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto td        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("td",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto template_ (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("template",   std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto textarea  (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("textarea",   std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto tfoot     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("tfoot",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto th        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("th",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto thead     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("thead",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto time      (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("time",       std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto title     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("title",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto tr        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("tr",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto track     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("track",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto u         (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("u",          std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto ul        (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("ul",         std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto var       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("var",        std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto video     (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("video",      std::forward<Ts>(args)...); }
+      template<typename ... Ts> auto wbr       (Ts&&... args) -> expr_element<Ts...> { return expr::create_element("wbr",        std::forward<Ts>(args)...); }
+   } // namespace expr
 } // namespace cheap
 
 
@@ -203,8 +1037,89 @@ namespace cheap::detail
    template<typename alternative_type, typename variant_type>
    concept is_alternative_c = is_alternative<alternative_type, variant_type>::value;
 
+   auto add_element_params(element& result, const std::span<const element_param> params) -> void;
+
+   constexpr std::string_view void_elements[] = { "area", "base", "br", "col", "embed", "hr", "img", "input", "link", "meta", "source", "track", "wbr" };
+   constexpr std::string_view raw_text_elements[] = { "script", "style" };
+   constexpr std::string_view url_attributes[] = { "action", "cite", "formaction", "href", "poster", "src" };
+
+   // Where a string lands decides what has to be escaped. Attribute values are double-quoted, URLs are
+   // percent-encoded on top of that and script or style contents only need to be kept from ending early
+   enum class escape_context { text, attribute_value, url, raw_text };
+   [[nodiscard]] constexpr auto get_attribute_context(const std::string_view name) -> escape_context;
+   [[nodiscard]] constexpr auto get_content_context(const std::string_view element_name) -> escape_context;
+   [[nodiscard]] constexpr auto get_escape_sequence(const char ch, const escape_context context = escape_context::text) -> std::string_view;
+
+   // Length of the UTF-8 sequence that starts at pos and whether it's valid. Invalid sequences have the
+   // length of their maximal subpart, which is replaced as a whole
+   [[nodiscard]] constexpr auto get_utf8_sequence(const std::string_view str, const std::size_t pos) -> std::pair<std::size_t, bool>;
+   [[nodiscard]] constexpr auto is_valid_utf8(const std::string_view str) -> bool;
+   [[noreturn]] auto throw_invalid_utf8(const std::size_t offset) -> void;
+   // Replacements made on this thread, the render functions report the difference
+   inline thread_local std::size_t utf8_replacement_count = 0;
+
+   template<typename T>
+   using static_content_t = std::conditional_t<std::is_convertible_v<T, std::string_view>, std::string_view, T>;
+
+   struct size_writer
+   {
+      std::size_t m_size = 0;
+      constexpr auto put(const char) -> void { ++m_size; }
+      constexpr auto put(const std::string_view str) -> void { m_size += str.size(); }
+   };
+   struct buffer_writer
+   {
+      char* m_pos;
+      constexpr auto put(const char ch) -> void { *m_pos++ = ch; }
+      constexpr auto put(const std::string_view str) -> void { for (const char ch : str) *m_pos++ = ch; }
+   };
+
+   template<fixed_string name, typename ... Ts, typename fun_type>
+   constexpr auto for_each_static_content(const static_element<name, Ts...>& elem, const fun_type& fun) -> void;
+   template<typename sink_type>
+   struct sink_writer
+   {
+      sink_type& m_sink;
+      auto put(const char ch) -> void
+      {
+         if constexpr (requires { m_sink.push_back(ch); })
+            m_sink.push_back(ch);
+         else
+            m_sink.append(&ch, &ch + 1);
+      }
+      auto put(const std::string_view str) -> void { m_sink.append(str.data(), str.data() + str.size()); }
+   };
+
+   template<typename T>
+   constexpr bool is_attribute_like = is_any_of<std::remove_cvref_t<T>, attribute, bool_attribute, string_attribute>;
+
+   template<typename writer_type>
+   constexpr auto write_indentation_to(const int level, const options& opt, writer_type& writer) -> void;
+   template<typename writer_type>
+   constexpr auto write_escaped_to(const std::string_view str, const options& opt, writer_type& writer, const escape_context context = escape_context::text) -> void;
+   template<typename writer_type>
+   constexpr auto write_static_attribute(const static_attribute& attrib, const options& opt, writer_type& writer) -> void;
+   template<typename writer_type>
+   constexpr auto write_static_content(const std::string_view text, const int level, const options& opt, writer_type& writer, const escape_context context = escape_context::text) -> void;
+   template<typename writer_type, fixed_string name, typename ... Ts>
+   constexpr auto write_static_content(const static_element<name, Ts...>& elem, const int level, const options& opt, writer_type& writer) -> void;
+
+   template<typename writer_type>
+   auto write_expr_attribute(const bool_attribute& attrib, const options& opt, writer_type& writer) -> void;
+   template<typename writer_type>
+   auto write_expr_attribute(const string_attribute& attrib, const options& opt, writer_type& writer) -> void;
+   template<typename writer_type>
+   auto write_expr_attribute(const attribute& attrib, const options& opt, writer_type& writer) -> void;
    template<typename T>
-   auto process_variadic_param(element& result, T&& arg) -> void;
+   constexpr bool is_verbatim_text = is_any_of<std::remove_cvref_t<T>, raw_html, escaped_text>;
+   template<typename writer_type, typename T>
+   auto write_expr_text(const T& text, const options& opt, writer_type& writer, const escape_context context = escape_context::text) -> void;
+   template<typename writer_type, typename T>
+   auto write_expr_content(const T& text, const int level, const options& opt, writer_type& writer) -> void;
+   template<typename writer_type, typename T> requires is_any_of<T, element, column_table, html_callback>
+   auto write_expr_content(const T& tree, const int level, const options& opt, writer_type& writer, const escape_context context) -> void;
+   template<typename writer_type, typename ... Ts>
+   auto write_expr_content(const expr_element<Ts...>& elem, const int level, const options& opt, writer_type& writer) -> void;
 
 
    struct indentation_helper
@@ -218,20 +1133,138 @@ namespace cheap::detail
       [[nodiscard]] auto get_next_level() const -> indentation_helper;
       auto write_indentation_str(const options& opt, std::string& output) const -> void;
       [[nodiscard]] auto is_at_origin() const -> bool;
+      [[nodiscard]] auto get_level() const -> int;
    };
 
+   template<typename T>
+   concept element_like = is_any_of<T, element, element_view>;
+   template<typename T>
+   concept text_like = is_any_of<T, std::string, std::string_view, raw_html, escaped_text, text, long long, unsigned long long, double, date_time>;
+
+   template<typename T>
+   auto write_attribute_alternative(const T& alternative, std::string& output, const options& opt) -> void;
    auto write_attribute_string(const attribute& attrib, std::string& output, const options& opt) -> void;
-   auto write_attributes_str(const std::vector<attribute>& attributes, const options& opt, std::string& output) -> void;
+   auto write_attribute_string(const attribute_view& attrib, std::string& output, const options& opt) -> void;
+   template<typename attribute_range>
+   auto write_attributes_str(const attribute_range& attributes, const options& opt, std::string& output) -> void;
    auto write_repeated_char(const int count, const char ch, std::string& output) -> void;
-   auto replace_all(std::string& inout, const std::string_view what, const std::string_view with) -> void;
-   [[nodiscard]] auto get_escaped(const std::string& in, const options& opt) -> std::string;
-   auto write_element_str_impl(const std::string& elem, const indentation_helper& indentation, const options& opt, std::string& output) -> void;
+   auto write_text_str(const std::string_view text, const options& opt, std::string& output, const escape_context context = escape_context::text) -> void;
+   auto write_text_str(const raw_html& html, const options& opt, std::string& output, const escape_context context = escape_context::text) -> void;
+   auto write_text_str(const escaped_text& text, const options& opt, std::string& output, const escape_context context = escape_context::text) -> void;
+   auto write_text_str(const text& cached, const options& opt, std::string& output, const escape_context context = escape_context::text) -> void;
+   [[nodiscard]] auto get_text_cache_key(const options& opt, const escape_context context) -> std::uint8_t;
+   auto write_text_str(const long long number, const options& opt, std::string& output, const escape_context context = escape_context::text) -> void;
+   auto write_text_str(const unsigned long long number, const options& opt, std::string& output, const escape_context context = escape_context::text) -> void;
+   auto write_text_str(const double number, const options& opt, std::string& output, const escape_context context = escape_context::text) -> void;
+   auto write_text_str(const date_time time, const options& opt, std::string& output, const escape_context context = escape_context::text) -> void;
+   auto to_chars_date_time(char* first, const date_time time) -> char*;
+   [[nodiscard]] auto is_same_leaf(const content& a, const content& b) -> bool;
+   template<text_like text_type>
+   auto write_text_str(const text_type& text, const options& opt, scatter_output& output, const escape_context context = escape_context::text) -> void;
+   [[nodiscard]] auto get_buffer(std::string& output) -> std::string&;
+   [[nodiscard]] auto get_buffer(scatter_output& output) -> std::string&;
+
+   struct stream_output
+   {
+      output_stream& m_stream;
+      std::string m_buffer;
+      std::size_t m_flushed_size = 0;
+      static constexpr std::size_t chunk_size = 64 * 1024;
+      auto flush() -> void;
+   };
+   [[nodiscard]] auto get_buffer(stream_output& output) -> std::string&;
+   template<text_like text_type>
+   auto write_text_str(const text_type& text, const options& opt, stream_output& output, const escape_context context = escape_context::text) -> void;
+   template<typename output_type>
+   auto flush_if_full(output_type& target) -> void;
+   // Stream renders with a render_context per thread, so repeated small renders don't allocate
+   auto write_reused_stream(const element& elem, output_stream& stream, const options& opt) -> void;
+   auto write_reused_stream(const element_view& elem, output_stream& stream, const options& opt) -> void;
+   template<typename iterator_type>
+   struct iterator_stream final : output_stream
+   {
+      iterator_type m_out;
+      explicit iterator_stream(iterator_type out) : m_out(std::move(out)) {}
+      auto write(const std::string_view chunk) -> void override;
+   };
+   // The container of a back_insert_iterator, like fmt::appender, so chunks can be appended in one piece
+   template<typename container_type>
+   [[nodiscard]] auto get_container(std::back_insert_iterator<container_type>& it) -> container_type&;
+   // Shared by the std::format and fmt formatters of elements. The format spec is the initial
+   // indentation level, e.g. "{:2}"
+   template<typename error_type>
+   struct element_formatter
+   {
+      options m_options{};
+      template<typename parse_context>
+      constexpr auto parse(parse_context& context) -> decltype(context.begin());
+      template<typename element_type, typename format_context>
+      auto format(const element_type& elem, format_context& context) const -> decltype(context.out());
+   };
 
-   auto get_inner_html_str(const element& elem, const indentation_helper& indentation, const options& opt, std::string& output) -> void;
-   auto write_element_str_impl(const element& elem, const indentation_helper& indentation, const options& opt, std::string& output) -> void;
+   [[nodiscard]] auto get_crc32(std::uint32_t crc, const std::string_view data) -> std::uint32_t;
+   [[nodiscard]] auto get_adler32(std::uint32_t adler, const std::string_view data) -> std::uint32_t;
+   // Length-limited Huffman code lengths and the matching canonical codes, bit-reversed for writing
+   auto get_huffman_lengths(std::span<const std::uint32_t> frequencies, const int max_length, std::span<std::uint8_t> lengths) -> void;
+   auto get_huffman_codes(std::span<const std::uint8_t> lengths, std::span<std::uint16_t> codes) -> void;
+   [[nodiscard]] auto get_length_code(const std::size_t length) -> int;
+   [[nodiscard]] auto get_distance_code(const std::size_t distance) -> int;
+   [[nodiscard]] auto read_little_endian(const unsigned char* data, const int size) -> std::uint64_t;
+   [[nodiscard]] auto xxh64_round(std::uint64_t accumulator, const std::uint64_t input) -> std::uint64_t;
+   auto sha256_compress(std::uint32_t (&state)[8], const unsigned char* block) -> void;
+   [[nodiscard]] auto get_table_element(const column_table& table) -> element;
+   template<typename output_type>
+   auto write_snapshot_node(const snapshot& snap, const std::uint32_t index, const indentation_helper& indentation, const options& opt, output_type& target, const escape_context context = escape_context::text) -> void;
+   [[nodiscard]] auto find_either(const std::string_view str, std::size_t pos, const char first, const char second) -> std::size_t;
+   auto append_decoded(const std::string_view str, std::string& output) -> void;
+   template<text_like text_type, typename output_type>
+   auto write_element_str_impl(const text_type& text, const indentation_helper& indentation, const options& opt, output_type& target, render_map* map, const escape_context context = escape_context::text) -> void;
+   template<typename output_type>
+   auto write_element_str_impl(const column_table& table, const indentation_helper& indentation, const options& opt, output_type& target, render_map* map) -> void;
+   extern template auto write_element_str_impl<std::string>(const column_table&, const indentation_helper&, const options&, std::string&, render_map*) -> void;
+   extern template auto write_element_str_impl<scatter_output>(const column_table&, const indentation_helper&, const options&, scatter_output&, render_map*) -> void;
+   extern template auto write_element_str_impl<stream_output>(const column_table&, const indentation_helper&, const options&, stream_output&, render_map*) -> void;
+   template<typename output_type>
+   auto write_element_str_impl(const html_callback& callback, const indentation_helper& indentation, const options& opt, output_type& target, render_map* map, const escape_context context = escape_context::text) -> void;
+   extern template auto write_element_str_impl<std::string>(const html_callback&, const indentation_helper&, const options&, std::string&, render_map*, const escape_context) -> void;
+   extern template auto write_element_str_impl<scatter_output>(const html_callback&, const indentation_helper&, const options&, scatter_output&, render_map*, const escape_context) -> void;
+   extern template auto write_element_str_impl<stream_output>(const html_callback&, const indentation_helper&, const options&, stream_output&, render_map*, const escape_context) -> void;
+   [[nodiscard]] auto get_row_count(const column_table& table) -> std::size_t;
+
+   // Defined and instantiated for element and element_view in the implementation, rendering either
+   // into a string or a scatter_output
+   template<element_like element_type, typename output_type>
+   auto get_inner_html_str(const element_type& elem, const indentation_helper& indentation, const options& opt, output_type& target, render_map* map) -> void;
+   template<element_like element_type, typename output_type>
+   auto write_element_str_impl(const element_type& elem, const indentation_helper& indentation, const options& opt, output_type& target, render_map* map) -> void;
+   extern template auto write_element_str_impl<element, std::string>(const element&, const indentation_helper&, const options&, std::string&, render_map*) -> void;
+   extern template auto write_element_str_impl<element_view, std::string>(const element_view&, const indentation_helper&, const options&, std::string&, render_map*) -> void;
+   extern template auto write_element_str_impl<element, scatter_output>(const element&, const indentation_helper&, const options&, scatter_output&, render_map*) -> void;
+   extern template auto write_element_str_impl<element_view, scatter_output>(const element_view&, const indentation_helper&, const options&, scatter_output&, render_map*) -> void;
+   extern template auto write_element_str_impl<element, stream_output>(const element&, const indentation_helper&, const options&, stream_output&, render_map*) -> void;
+   extern template auto write_element_str_impl<element_view, stream_output>(const element_view&, const indentation_helper&, const options&, stream_output&, render_map*) -> void;
+   template<element_like element_type>
+   auto write_stream_impl(const element_type& elem, output_stream& stream, const options& opt, std::string* reused_buffer = nullptr) -> void;
+   template<element_like element_type>
+   auto render_with_context(render_context& context, const element_type& elem, std::string& output) -> void;
+   template<element_like element_type>
+   auto render_with_context(render_context& context, const element_type& elem, output_stream& stream) -> void;
+   [[nodiscard]] auto find_reservation(const template_key key, const bool is_added) -> reservation_statistics*;
+   template<element_like element_type>
+   auto write_reserved_str(const element_type& elem, std::string& output, const template_key key, const options& opt) -> void;
+   [[nodiscard]] auto get_view_hashes(const element_view& elem) -> std::pair<std::size_t, std::size_t>;
+   auto assert_views_unchanged(const element_view& elem) -> void;
+   auto collect_changes(const element& before, const element& after, content_path& path, std::vector<content_path>& changes) -> void;
+   auto rewrite_content(const element& after, const content_path& path, std::string& output, render_map& map, const options& opt) -> void;
+   auto write_patches(const element& before, const element& after, content_path& path, const options& opt, std::string& output) -> void;
+   auto write_attribute_patches(const element& before, const element& after, const content_path& path, std::string& output) -> void;
+   auto write_patch_head(const std::string_view op, const content_path& path, std::string& output) -> void;
+   auto write_patch_html(const content& html, const options& opt, std::string& output) -> void;
+   auto write_json_string(const std::string_view str, std::string& output) -> void;
    [[nodiscard]] auto get_attribute_name(const attribute& attrib) -> std::string;
-   [[nodiscard]] auto is_in(const std::span<const std::string_view> choices, const std::string& value) -> bool;
+   [[nodiscard]] auto is_in(const std::span<const std::string_view> choices, const std::string_view value) -> bool;
    auto assert_attrib_valid(const attribute& attrib) -> void;
+   [[nodiscard]] auto is_self_closing(const std::string_view name) -> bool;
    auto assert_string_enum_choice(const attribute& attrib, const std::span<const std::string_view> choices) -> void;
 
 } // namespace cheap::detail
@@ -250,517 +1283,5190 @@ namespace cheap::detail
 // template function definitions
 
 template<typename ... Ts>
-auto cheap::create_element(Ts&&... args) -> element
+auto cheap::expr::create_element(const std::string_view name, Ts&&... args) -> expr_element<Ts...>
 {
-   static_assert(sizeof...(args) > 0, "At least set a name");
+   return expr_element<Ts...>{ name, std::tuple<Ts...>{ std::forward<Ts>(args)... } };
+}
 
-   element result{};
-   (detail::process_variadic_param(result, std::forward<Ts>(args)), ...);
 
-   if (result.m_name.empty())
-   {
-      throw cheap_exception{ "No name set" };
-   }
-   return result;
+template<typename ... Ts>
+template<cheap::output_sink sink_type>
+auto cheap::expr_element<Ts...>::render_to(sink_type& sink, const options& opt) const -> void
+{
+   detail::sink_writer<sink_type> writer{ sink };
+   detail::write_expr_content(*this, opt.initial_level, opt, writer);
 }
 
 
-template<typename T>
-auto cheap::detail::process_variadic_param(element& result, T&& arg) -> void
+template<typename ... Ts>
+auto cheap::expr_element<Ts...>::to_element() const -> element
 {
-   if constexpr (is_any_of<T, element, attribute, bool_attribute, string_attribute, std::string> == false)
-   {
-      process_variadic_param(result, std::string{ arg });
-   }
-   else if constexpr (std::same_as<T, std::string>)
-   {
-      // string as first parameter -> element name
-      if (result.m_name.empty())
-      {
-         result.m_name = arg;
-      }
-
+   element result{ m_name };
+   const auto arg_converter = [&]<typename T>(const T& arg) {
+      if constexpr (detail::is_attribute_like<T>)
+         result.m_attributes.emplace_back(arg);
+      else if constexpr (detail::is_any_of<T, element, raw_html, escaped_text, text, date_time, column_table, html_callback>)
+         result.m_inner_html.emplace_back(arg);
+      else if constexpr (detail::number_like<T>)
+         result.m_inner_html.emplace_back(detail::to_number_content(arg));
+      else if constexpr (requires { arg.to_element(); })
+         result.m_inner_html.emplace_back(arg.to_element());
       else
-      {
-         result.m_inner_html.push_back(arg);
-      }
-   }
-   else if constexpr (is_any_of<T, attribute, bool_attribute, string_attribute>)
-   {
-      result.m_attributes.push_back(arg);
-   }
-   else if constexpr (std::same_as<T, element>)
-   {
-      result.m_inner_html.push_back(arg);
-   }
+         result.m_inner_html.emplace_back(std::string{ std::string_view{ arg } });
+   };
+   std::apply([&](const auto& ... args) { (arg_converter(args), ...); }, m_args);
+   return result;
 }
 
 
+template<typename T, std::size_t inline_capacity>
+cheap::small_vector<T, inline_capacity>::small_vector() noexcept
+   : m_data(get_inline())
+{
 
+}
 
 
+template<typename T, std::size_t inline_capacity>
+cheap::small_vector<T, inline_capacity>::small_vector(std::initializer_list<T> values)
+   : small_vector()
+{
+   assign(const_cast<T*>(values.begin()), values.size(), false);
+}
 
 
+template<typename T, std::size_t inline_capacity>
+cheap::small_vector<T, inline_capacity>::small_vector(const std::vector<T>& values)
+   : small_vector()
+{
+   assign(const_cast<T*>(values.data()), values.size(), false);
+}
 
 
+template<typename T, std::size_t inline_capacity>
+cheap::small_vector<T, inline_capacity>::small_vector(std::vector<T>&& values)
+   : small_vector()
+{
+   assign(values.data(), values.size(), true);
+}
 
 
-#ifdef CHEAP_IMPL
+template<typename T, std::size_t inline_capacity>
+cheap::small_vector<T, inline_capacity>::small_vector(const small_vector& other)
+   : small_vector()
+{
+   assign(const_cast<T*>(other.m_data), other.m_size, false);
+}
 
 
-auto cheap::detail::indentation_helper::get_next_level() const -> indentation_helper
+template<typename T, std::size_t inline_capacity>
+cheap::small_vector<T, inline_capacity>::small_vector(small_vector&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+   : small_vector()
 {
-   indentation_helper result = *this;
-   ++result.m_current_level;
-   return result;
+   *this = std::move(other);
 }
 
 
-auto cheap::detail::indentation_helper::write_indentation_str(const options& opt, std::string& output) const -> void
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::operator=(const small_vector& other) -> small_vector&
 {
-   if(opt.indent_with_tab)
+   if (this != &other)
    {
-      write_repeated_char(m_current_level, '\t', output);
+      clear();
+      assign(const_cast<T*>(other.m_data), other.m_size, false);
    }
-   else
+   return *this;
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::operator=(small_vector&& other) noexcept(std::is_nothrow_move_constructible_v<T>) -> small_vector&
+{
+   if (this == &other)
+      return *this;
+   clear();
+   if (other.is_inline())
    {
-      write_repeated_char(m_current_level * m_indentation, ' ', output);
+      // Inline values have to be moved one by one, allocated ones change owner
+      assign(other.m_data, other.m_size, true);
+      other.clear();
+      return *this;
+   }
+   if (is_inline() == false)
+      std::allocator<T>{}.deallocate(m_data, m_capacity);
+   m_data = std::exchange(other.m_data, other.get_inline());
+   m_size = std::exchange(other.m_size, 0);
+   m_capacity = std::exchange(other.m_capacity, inline_capacity);
+   return *this;
+}
+
+
+template<typename T, std::size_t inline_capacity>
+cheap::small_vector<T, inline_capacity>::~small_vector()
+{
+   clear();
+   if (is_inline() == false)
+      std::allocator<T>{}.deallocate(m_data, m_capacity);
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::reallocate(const std::size_t capacity) -> void
+{
+   T* const data = std::allocator<T>{}.allocate(capacity);
+   std::uninitialized_move_n(m_data, m_size, data);
+   std::destroy_n(m_data, m_size);
+   if (is_inline() == false)
+      std::allocator<T>{}.deallocate(m_data, m_capacity);
+   m_data = data;
+   m_capacity = capacity;
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::assign(
+   T* first,
+   const std::size_t count,
+   const bool is_move
+) -> void
+{
+   reserve(count);
+   if (is_move)
+      std::uninitialized_move_n(first, count, m_data);
+   else
+      std::uninitialized_copy_n(first, count, m_data);
+   m_size = count;
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::reserve(const std::size_t capacity) -> void
+{
+   if (capacity > m_capacity)
+      reallocate(capacity);
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::clear() -> void
+{
+   std::destroy_n(m_data, m_size);
+   m_size = 0;
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::push_back(const T& value) -> void
+{
+   emplace_back(value);
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::push_back(T&& value) -> void
+{
+   emplace_back(std::move(value));
+}
+
+
+template<typename T, std::size_t inline_capacity>
+template<typename ... Ts>
+auto cheap::small_vector<T, inline_capacity>::emplace_back(Ts&&... args) -> T&
+{
+   if (m_size == m_capacity)
+   {
+      // The arguments might refer to a value of this vector, so the new one is created first
+      T value(std::forward<Ts>(args)...);
+      reallocate(std::max<std::size_t>(2 * m_capacity, 4));
+      return *std::construct_at(m_data + m_size++, std::move(value));
+   }
+   return *std::construct_at(m_data + m_size++, std::forward<Ts>(args)...);
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::pop_back() -> void
+{
+   std::destroy_at(m_data + --m_size);
+}
+
+
+template<typename T, std::size_t inline_capacity>
+auto cheap::small_vector<T, inline_capacity>::operator==(const small_vector& other) const -> bool
+{
+   return std::equal(begin(), end(), other.begin(), other.end());
+}
+
+
+
+template<std::size_t N>
+constexpr cheap::fixed_string<N>::fixed_string(const char (&str)[N])
+{
+   std::copy_n(str, N, m_data);
+}
+
+
+template<std::size_t N>
+constexpr auto cheap::fixed_string<N>::view() const -> std::string_view
+{
+   return { m_data, N - 1 };
+}
+
+
+constexpr cheap::static_attribute::static_attribute(const std::string_view str)
+{
+   const auto equal_pos = str.find('=');
+   m_name = str.substr(0, equal_pos);
+   if (equal_pos != std::string_view::npos)
+   {
+      m_value = str.substr(equal_pos + 1);
+      m_is_bool = false;
+   }
+}
+
+
+template<cheap::fixed_string name, typename ... Ts>
+constexpr auto cheap::make_static(Ts... args)
+{
+   constexpr bool has_children = (!std::same_as<Ts, static_attribute> || ...);
+   static_assert(
+      std::ranges::find(detail::void_elements, name.view()) == std::end(detail::void_elements) || !has_children,
+      "Self-closing elements can't have children"
+   );
+   return static_element<name, detail::static_content_t<Ts>...>{ {detail::static_content_t<Ts>(args)...} };
+}
+
+
+template<cheap::options opt, typename builder_type>
+consteval auto cheap::render_static(builder_type)
+{
+   // Captureless lambdas are default constructible, so the tree can be rebuilt in constant expressions
+   constexpr std::size_t size = [] {
+      detail::size_writer writer;
+      detail::write_static_content(builder_type{}(), opt.initial_level, opt, writer);
+      return writer.m_size;
+   }();
+
+   fixed_string<size + 1> result;
+   detail::buffer_writer writer{ result.m_data };
+   detail::write_static_content(builder_type{}(), opt.initial_level, opt, writer);
+   return result;
+}
+
+
+namespace cheap::detail
+{
+   // "%00%01...%FF", the percent-encodings are views into it
+   inline constexpr std::array<char, 3 * 256> percent_encodings = [] {
+      constexpr std::string_view digits = "0123456789ABCDEF";
+      std::array<char, 3 * 256> result{};
+      for (std::size_t i = 0; i < 256; ++i)
+      {
+         result[3 * i] = '%';
+         result[3 * i + 1] = digits[i / 16];
+         result[3 * i + 2] = digits[i % 16];
+      }
+      return result;
+   }();
+
+   // What every byte is replaced with per context, see get_escape_sequence()
+   enum class escape_kind : std::uint8_t { none, amp, lt, gt, quot, percent };
+   inline constexpr std::array<std::array<escape_kind, 256>, 4> escape_tables = [] {
+      std::array<std::array<escape_kind, 256>, 4> result{};
+      for (std::size_t i = 0; i < 3; ++i)
+      {
+         result[i]['&'] = escape_kind::amp;
+         result[i]['<'] = escape_kind::lt;
+         result[i]['>'] = escape_kind::gt;
+      }
+      result[static_cast<std::size_t>(escape_context::attribute_value)]['"'] = escape_kind::quot;
+
+      // Characters that can't appear in URLs, reserved ones like / ? # are kept
+      auto& url = result[static_cast<std::size_t>(escape_context::url)];
+      for (std::size_t i = 0; i < 256; ++i)
+      {
+         if (i <= 0x20 || i >= 0x7F || i == '"' || i == '<' || i == '>' || i == '`' || i == '{' || i == '}')
+            url[i] = escape_kind::percent;
+      }
+      return result;
+   }();
+}
+
+
+constexpr auto cheap::detail::get_attribute_context(const std::string_view name) -> escape_context
+{
+   return std::ranges::find(url_attributes, name) != std::end(url_attributes) ? escape_context::url : escape_context::attribute_value;
+}
+
+
+constexpr auto cheap::detail::get_content_context(const std::string_view element_name) -> escape_context
+{
+   return std::ranges::find(raw_text_elements, element_name) != std::end(raw_text_elements) ? escape_context::raw_text : escape_context::text;
+}
+
+
+constexpr auto cheap::detail::get_escape_sequence(
+   const char ch,
+   const escape_context context
+) -> std::string_view
+{
+   const auto byte = static_cast<unsigned char>(ch);
+   switch (escape_tables[static_cast<std::size_t>(context)][byte])
+   {
+   case escape_kind::amp: return "&amp;";
+   case escape_kind::lt: return "&lt;";
+   case escape_kind::gt: return "&gt;";
+   case escape_kind::quot: return "&quot;";
+   case escape_kind::percent: return { percent_encodings.data() + 3 * byte, 3 };
+   default: return {};
+   }
+}
+
+
+template<cheap::fixed_string name, typename ... Ts, typename fun_type>
+constexpr auto cheap::detail::for_each_static_content(
+   const static_element<name, Ts...>& elem,
+   const fun_type& fun
+) -> void
+{
+   std::apply([&](const auto& ... contents) { (fun(contents), ...); }, elem.m_contents);
+}
+
+
+template<typename writer_type>
+constexpr auto cheap::detail::write_indentation_to(
+   const int level,
+   const options& opt,
+   writer_type& writer
+) -> void
+{
+   const int count = opt.indent_with_tab ? level : level * opt.indentation;
+   for (int i = 0; i < count; ++i)
+      writer.put(opt.indent_with_tab ? '\t' : ' ');
+}
+
+
+constexpr auto cheap::detail::get_utf8_sequence(
+   const std::string_view str,
+   const std::size_t pos
+) -> std::pair<std::size_t, bool>
+{
+   const auto lead = static_cast<unsigned char>(str[pos]);
+   if (lead < 0x80)
+      return { 1, true };
+   std::size_t length = 0;
+   unsigned char second_min = 0x80;
+   unsigned char second_max = 0xBF;
+   if (lead >= 0xC2 && lead <= 0xDF)
+      length = 2;
+   else if (lead >= 0xE0 && lead <= 0xEF)
+   {
+      length = 3;
+      if (lead == 0xE0)
+         second_min = 0xA0; // Overlong
+      else if (lead == 0xED)
+         second_max = 0x9F; // Surrogates
+   }
+   else if (lead >= 0xF0 && lead <= 0xF4)
+   {
+      length = 4;
+      if (lead == 0xF0)
+         second_min = 0x90; // Overlong
+      else if (lead == 0xF4)
+         second_max = 0x8F; // Beyond U+10FFFF
+   }
+   else
+      return { 1, false };
+
+   for (std::size_t i = 1; i < length; ++i)
+   {
+      if (pos + i >= str.size())
+         return { i, false };
+      const auto byte = static_cast<unsigned char>(str[pos + i]);
+      const unsigned char min = i == 1 ? second_min : 0x80;
+      const unsigned char max = i == 1 ? second_max : 0xBF;
+      if (byte < min || byte > max)
+         return { i, false };
+   }
+   return { length, true };
+}
+
+
+constexpr auto cheap::detail::is_valid_utf8(const std::string_view str) -> bool
+{
+   for (std::size_t i = 0; i < str.size(); )
+   {
+      if (static_cast<unsigned char>(str[i]) < 0x80)
+      {
+         ++i;
+         continue;
+      }
+      const auto [length, is_valid] = get_utf8_sequence(str, i);
+      if (is_valid == false)
+         return false;
+      i += length;
+   }
+   return true;
+}
+
+
+template<typename writer_type>
+constexpr auto cheap::detail::write_escaped_to(
+   const std::string_view str,
+   const options& opt,
+   writer_type& writer,
+   const escape_context context
+) -> void
+{
+   // Unescaped runs are written in one piece
+   std::size_t run_begin = 0;
+   if (opt.utf8 != utf8_handling::unchecked)
+   {
+      // Same as below, but every byte is checked for escaping and UTF-8 in a single pass
+      const std::array<escape_kind, 256>& table = escape_tables[static_cast<std::size_t>(context == escape_context::raw_text ? escape_context::text : context)];
+      for (std::size_t i = 0; i < str.size(); )
+      {
+         const auto byte = static_cast<unsigned char>(str[i]);
+         if (byte < 0x80)
+         {
+            if (opt.escaping && context == escape_context::raw_text)
+            {
+               if (byte == '<' && i + 1 < str.size() && str[i + 1] == '/')
+               {
+                  writer.put(str.substr(run_begin, i + 1 - run_begin));
+                  writer.put("\\/");
+                  run_begin = i + 2;
+                  ++i;
+               }
+            }
+            else if (opt.escaping && table[byte] != escape_kind::none)
+            {
+               writer.put(str.substr(run_begin, i - run_begin));
+               writer.put(get_escape_sequence(str[i], context));
+               run_begin = i + 1;
+            }
+            ++i;
+            continue;
+         }
+         const auto [length, is_valid] = get_utf8_sequence(str, i);
+         const bool is_percent_encoded = opt.escaping && context == escape_context::url;
+         if (is_valid == false)
+         {
+            if (opt.utf8 == utf8_handling::validate)
+               throw_invalid_utf8(i);
+            writer.put(str.substr(run_begin, i - run_begin));
+            writer.put(is_percent_encoded ? "%EF%BF%BD" : "\xEF\xBF\xBD");
+            run_begin = i + length;
+            if (std::is_constant_evaluated() == false)
+               ++utf8_replacement_count;
+         }
+         else if (is_percent_encoded)
+         {
+            writer.put(str.substr(run_begin, i - run_begin));
+            for (std::size_t j = i; j < i + length; ++j)
+               writer.put(get_escape_sequence(str[j], context));
+            run_begin = i + length;
+         }
+         i += length;
+      }
+      writer.put(str.substr(run_begin));
+      return;
+   }
+   if (opt.escaping == false)
+   {
+      writer.put(str);
+      return;
+   }
+   if (context == escape_context::raw_text)
+   {
+      // Character references aren't decoded in script and style, only an end tag could end them early
+      for (std::size_t pos = str.find("</"); pos != std::string_view::npos; pos = str.find("</", run_begin))
+      {
+         writer.put(str.substr(run_begin, pos + 1 - run_begin));
+         writer.put("\\/");
+         run_begin = pos + 2;
+      }
+      writer.put(str.substr(run_begin));
+      return;
+   }
+   const std::array<escape_kind, 256>& table = escape_tables[static_cast<std::size_t>(context)];
+   for (std::size_t i = 0; i < str.size(); ++i)
+   {
+      if (table[static_cast<unsigned char>(str[i])] == escape_kind::none)
+         continue;
+      writer.put(str.substr(run_begin, i - run_begin));
+      writer.put(get_escape_sequence(str[i], context));
+      run_begin = i + 1;
+   }
+   writer.put(str.substr(run_begin));
+}
+
+
+template<typename writer_type>
+constexpr auto cheap::detail::write_static_attribute(
+   const static_attribute& attrib,
+   const options& opt,
+   writer_type& writer
+) -> void
+{
+   writer.put(' ');
+   write_escaped_to(attrib.m_name, opt, writer);
+   if (attrib.m_is_bool)
+      return;
+   writer.put("=\"");
+   write_escaped_to(attrib.m_value, opt, writer, get_attribute_context(attrib.m_name));
+   writer.put('\"');
+}
+
+
+template<typename writer_type>
+constexpr auto cheap::detail::write_static_content(
+   const std::string_view text,
+   const int level,
+   const options& opt,
+   writer_type& writer,
+   const escape_context context
+) -> void
+{
+   write_indentation_to(level, opt, writer);
+   write_escaped_to(text, opt, writer, context);
+}
+
+
+template<typename writer_type, cheap::fixed_string name, typename ... Ts>
+constexpr auto cheap::detail::write_static_content(
+   const static_element<name, Ts...>& elem,
+   const int level,
+   const options& opt,
+   writer_type& writer
+) -> void
+{
+   constexpr std::size_t child_count = ((std::same_as<Ts, static_attribute> ? 0 : 1) + ... + 0);
+   constexpr bool is_trivial = child_count == 0 || (child_count == 1 && (std::same_as<Ts, std::string_view> || ...));
+   constexpr bool is_self_closing = std::ranges::find(void_elements, name.view()) != std::end(void_elements);
+   constexpr escape_context context = get_content_context(name.view());
+
+   write_indentation_to(level, opt, writer);
+   writer.put('<');
+   writer.put(name.view());
+   for_each_static_content(elem, [&]<typename T>(const T& x) {
+      if constexpr (std::same_as<T, static_attribute>)
+         write_static_attribute(x, opt, writer);
+   });
+
+   if constexpr (is_self_closing)
+   {
+      writer.put(" /");
+   }
+   else if constexpr (is_trivial)
+   {
+      writer.put('>');
+      for_each_static_content(elem, [&]<typename T>(const T& x) {
+         if constexpr (std::same_as<T, std::string_view>)
+            write_escaped_to(x, opt, writer, context);
+      });
+      writer.put("</");
+      writer.put(name.view());
+   }
+   else
+   {
+      writer.put(">\n");
+      bool first = true;
+      for_each_static_content(elem, [&]<typename T>(const T& x) {
+         if constexpr (std::same_as<T, static_attribute> == false)
+         {
+            if (first == false)
+               writer.put('\n');
+            first = false;
+            if constexpr (std::same_as<T, std::string_view>)
+               write_static_content(x, level + 1, opt, writer, context);
+            else
+               write_static_content(x, level + 1, opt, writer);
+         }
+      });
+      writer.put('\n');
+      write_indentation_to(level, opt, writer);
+      writer.put("</");
+      writer.put(name.view());
+   }
+
+   writer.put('>');
+   if (level == opt.initial_level && opt.end_with_newline)
+      writer.put('\n');
+}
+
+
+template<cheap::detail::number_like T>
+auto cheap::detail::to_number_content(const T number) -> number_content_t<T>
+{
+   if constexpr (std::same_as<T, float>)
+   {
+      char buffer[32];
+      const char* end = std::to_chars(std::begin(buffer), std::end(buffer), number).ptr;
+      double result = 0.0;
+      std::from_chars(buffer, end, result);
+      return result;
+   }
+   else
+   {
+      return static_cast<number_content_t<T>>(number);
+   }
+}
+
+
+template<typename T> requires std::is_arithmetic_v<T>
+cheap::detail::element_param::element_param(const T number)
+{
+   static_assert(number_like<T>, "Only numbers are supported, not booleans or characters");
+   using number_type = number_content_t<T>;
+   if constexpr (std::same_as<number_type, double>)
+   {
+      m_kind = kind::floating_number;
+      m_floating = to_number_content(number);
+   }
+   else if constexpr (std::same_as<number_type, long long>)
+   {
+      m_kind = kind::signed_number;
+      m_signed = number;
+   }
+   else
+   {
+      m_kind = kind::unsigned_number;
+      m_unsigned = number;
+   }
+}
+
+
+template<typename ... Ts>
+auto cheap::create_element(Ts&&... args) -> element
+{
+   static_assert(sizeof...(args) > 0, "At least set a name");
+
+   // The first string becomes the name
+   return detail::make_element({}, { detail::element_param(std::forward<Ts>(args))... });
+}
+
+
+template<typename writer_type>
+auto cheap::detail::write_expr_attribute(
+   const bool_attribute& attrib,
+   const options& opt,
+   writer_type& writer
+) -> void
+{
+   if (attrib.m_value == false)
+      return;
+   writer.put(' ');
+   write_escaped_to(attrib.m_name, opt, writer);
+}
+
+
+template<typename writer_type>
+auto cheap::detail::write_expr_attribute(
+   const string_attribute& attrib,
+   const options& opt,
+   writer_type& writer
+) -> void
+{
+   writer.put(' ');
+   write_escaped_to(attrib.m_name, opt, writer);
+   writer.put("=\"");
+   write_escaped_to(attrib.m_value, opt, writer, get_attribute_context(attrib.m_name));
+   writer.put('\"');
+}
+
+
+template<typename writer_type>
+auto cheap::detail::write_expr_attribute(
+   const attribute& attrib,
+   const options& opt,
+   writer_type& writer
+) -> void
+{
+   std::visit([&](const auto& alternative) { write_expr_attribute(alternative, opt, writer); }, attrib);
+}
+
+
+template<typename writer_type, typename T>
+auto cheap::detail::write_expr_text(
+   const T& text,
+   const options& opt,
+   writer_type& writer,
+   const escape_context context
+) -> void
+{
+   if constexpr (std::same_as<T, raw_html>)
+      writer.put(text.m_html);
+   else if constexpr (std::same_as<T, escaped_text>)
+      writer.put(text.m_text);
+   else if constexpr (std::same_as<T, cheap::text>)
+   {
+      if constexpr (std::same_as<writer_type, sink_writer<std::string>>)
+         write_text_str(text, opt, writer.m_sink, context);
+      else
+      {
+         std::string escaped;
+         write_text_str(text, opt, escaped, context);
+         writer.put(escaped);
+      }
+   }
+   else if constexpr (number_like<T>)
+   {
+      char buffer[32];
+      writer.put(std::string_view{ buffer, std::to_chars(std::begin(buffer), std::end(buffer), to_number_content(text)).ptr });
+   }
+   else if constexpr (std::same_as<T, date_time>)
+   {
+      char buffer[32];
+      writer.put(std::string_view{ buffer, to_chars_date_time(buffer, text) });
+   }
+   else
+      write_escaped_to(std::string_view{ text }, opt, writer, context);
+}
+
+
+template<typename writer_type, typename T>
+auto cheap::detail::write_expr_content(
+   const T& text,
+   const int level,
+   const options& opt,
+   writer_type& writer
+) -> void
+{
+   write_indentation_to(level, opt, writer);
+   write_expr_text(text, opt, writer);
+}
+
+
+template<typename writer_type, typename T> requires cheap::detail::is_any_of<T, cheap::element, cheap::column_table, cheap::html_callback>
+auto cheap::detail::write_expr_content(
+   const T& tree,
+   const int level,
+   const options& opt,
+   writer_type& writer,
+   const escape_context context
+) -> void
+{
+   options child_options = opt;
+   child_options.initial_level = level;
+   child_options.end_with_newline = false;
+   const auto write = [&](std::string& output) {
+      // Callbacks write text like the element they are in
+      if constexpr (std::same_as<T, html_callback>)
+         write_element_str_impl(tree, indentation_helper(child_options), child_options, output, nullptr, context);
+      else
+         write_element_str_impl(tree, indentation_helper(child_options), child_options, output, nullptr);
+   };
+   if constexpr (std::same_as<writer_type, sink_writer<std::string>>)
+   {
+      write(writer.m_sink);
+   }
+   else
+   {
+      std::string rendered;
+      write(rendered);
+      writer.put(rendered);
+   }
+}
+
+
+template<typename writer_type, typename ... Ts>
+auto cheap::detail::write_expr_content(
+   const expr_element<Ts...>& elem,
+   const int level,
+   const options& opt,
+   writer_type& writer
+) -> void
+{
+   constexpr std::size_t child_count = ((is_attribute_like<Ts> ? 0 : 1) + ... + 0);
+   // Lvalue arguments are stored as references
+   constexpr bool is_trivial = child_count == 0 || (child_count == 1 && ((std::is_convertible_v<Ts, std::string_view> || is_any_of<std::remove_cvref_t<Ts>, raw_html, escaped_text, text, date_time> || number_like<std::remove_cvref_t<Ts>>) || ...));
+   const bool is_self_closing = std::ranges::find(void_elements, elem.m_name) != std::end(void_elements);
+   const escape_context context = get_content_context(elem.m_name);
+   if (is_self_closing && child_count > 0)
+   {
+      std::string msg = "The used element (\"";
+      msg += elem.m_name;
+      msg += "\") is self-closing and can't have children";
+      throw cheap_exception{ msg };
+   }
+
+   const auto for_each_arg = [&](const auto& fun) {
+      std::apply([&](const auto& ... args) { (fun(args), ...); }, elem.m_args);
+   };
+
+   write_indentation_to(level, opt, writer);
+   writer.put('<');
+   writer.put(elem.m_name);
+   for_each_arg([&]<typename T>(const T& arg) {
+      if constexpr (is_attribute_like<T>)
+         write_expr_attribute(arg, opt, writer);
+   });
+
+   if (is_self_closing)
+   {
+      writer.put(" /");
+   }
+   else if constexpr (is_trivial)
+   {
+      writer.put('>');
+      for_each_arg([&]<typename T>(const T& arg) {
+         if constexpr (is_attribute_like<T> == false)
+            write_expr_text(arg, opt, writer, context);
+      });
+      writer.put("</");
+      writer.put(elem.m_name);
+   }
+   else
+   {
+      writer.put(">\n");
+      bool first = true;
+      for_each_arg([&]<typename T>(const T& arg) {
+         if constexpr (is_attribute_like<T> == false)
+         {
+            if (first == false)
+               writer.put('\n');
+            first = false;
+            if constexpr (std::is_convertible_v<T, std::string_view> || std::same_as<T, text>)
+            {
+               write_indentation_to(level + 1, opt, writer);
+               write_expr_text(arg, opt, writer, context);
+            }
+            else if constexpr (is_any_of<T, element, column_table, html_callback>)
+               write_expr_content(arg, level + 1, opt, writer, context);
+            else
+               write_expr_content(arg, level + 1, opt, writer);
+         }
+      });
+      writer.put('\n');
+      write_indentation_to(level, opt, writer);
+      writer.put("</");
+      writer.put(elem.m_name);
+   }
+
+   writer.put('>');
+   if (level == opt.initial_level && opt.end_with_newline)
+      writer.put('\n');
+}
+
+
+
+
+
+
+
+
+
+template<typename container_type>
+auto cheap::detail::get_container(
+   std::back_insert_iterator<container_type>& it
+) -> container_type&
+{
+   struct accessor : std::back_insert_iterator<container_type>
+   {
+      using std::back_insert_iterator<container_type>::container;
+   };
+   return *(it.*(&accessor::container));
+}
+
+
+template<typename iterator_type>
+auto cheap::detail::iterator_stream<iterator_type>::write(
+   const std::string_view chunk
+) -> void
+{
+   if constexpr (requires { typename iterator_type::container_type; })
+   {
+      if constexpr (std::derived_from<iterator_type, std::back_insert_iterator<typename iterator_type::container_type>>)
+      {
+         auto& container = cheap::detail::get_container<typename iterator_type::container_type>(m_out);
+         if constexpr (requires { container.append(chunk.data(), chunk.data() + chunk.size()); })
+         {
+            container.append(chunk.data(), chunk.data() + chunk.size());
+            return;
+         }
+         else if constexpr (requires { container.insert(container.end(), chunk.begin(), chunk.end()); })
+         {
+            container.insert(container.end(), chunk.begin(), chunk.end());
+            return;
+         }
+      }
+   }
+   m_out = std::copy(chunk.begin(), chunk.end(), std::move(m_out));
+}
+
+
+template<std::output_iterator<char> iterator_type>
+auto cheap::write_element_to(
+   const element& elem,
+   iterator_type out,
+   const options& opt
+) -> iterator_type
+{
+   detail::iterator_stream<iterator_type> stream{ std::move(out) };
+   detail::write_reused_stream(elem, stream, opt);
+   return std::move(stream.m_out);
+}
+
+
+template<std::output_iterator<char> iterator_type>
+auto cheap::write_element_to(
+   const element_view& elem,
+   iterator_type out,
+   const options& opt
+) -> iterator_type
+{
+   detail::iterator_stream<iterator_type> stream{ std::move(out) };
+   detail::write_reused_stream(elem, stream, opt);
+   return std::move(stream.m_out);
+}
+
+
+#ifdef CHEAP_USE_FMT
+template<std::size_t size>
+auto cheap::write_element_fmt(
+   const element& elem,
+   fmt::basic_memory_buffer<char, size>& buffer,
+   const options& opt
+) -> void
+{
+   write_element_to(elem, std::back_inserter(buffer), opt);
+}
+#endif
+
+
+template<typename error_type>
+template<typename parse_context>
+constexpr auto cheap::detail::element_formatter<error_type>::parse(
+   parse_context& context
+) -> decltype(context.begin())
+{
+   auto it = context.begin();
+   int level = 0;
+   bool has_level = false;
+   for (; it != context.end() && *it != '}'; ++it)
+   {
+      if (*it < '0' || *it > '9' || level > 1'000)
+         throw error_type{ "The format spec of elements is the initial indentation level" };
+      level = level * 10 + (*it - '0');
+      has_level = true;
+   }
+   if (has_level)
+      m_options.initial_level = level;
+   return it;
+}
+
+
+template<typename error_type>
+template<typename element_type, typename format_context>
+auto cheap::detail::element_formatter<error_type>::format(
+   const element_type& elem,
+   format_context& context
+) const -> decltype(context.out())
+{
+   return write_element_to(elem, context.out(), m_options);
+}
+
+
+template<cheap::detail::number_like T>
+auto cheap::html_writer::text(const T number) -> html_writer&
+{
+   begin_child(true);
+   detail::write_text_str(detail::to_number_content(number), m_options, m_output);
+   flush_if_full();
+   return *this;
+}
+
+
+template<typename output_type>
+auto cheap::detail::flush_if_full(output_type& target) -> void
+{
+   if constexpr (std::same_as<output_type, stream_output>)
+   {
+      if (target.m_buffer.size() >= stream_output::chunk_size)
+         target.flush();
+   }
+}
+
+#ifdef CHEAP_USE_FMT
+template<>
+struct fmt::formatter<cheap::element> : cheap::detail::element_formatter<fmt::format_error> {};
+template<>
+struct fmt::formatter<cheap::element_view> : cheap::detail::element_formatter<fmt::format_error> {};
+#endif
+#ifdef CHEAP_HAS_STD_FORMAT
+template<>
+struct std::formatter<cheap::element> : cheap::detail::element_formatter<std::format_error> {};
+template<>
+struct std::formatter<cheap::element_view> : cheap::detail::element_formatter<std::format_error> {};
+#endif
+
+
+#ifdef CHEAP_IMPL
+
+#if __has_include(<sys/mman.h>) && __has_include(<sys/stat.h>) && __has_include(<fcntl.h>) && __has_include(<unistd.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHEAP_HAS_MMAP
+#if defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+#define CHEAP_HAS_FALLOCATE
+#endif
+#endif
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+
+
+auto cheap::detail::indentation_helper::get_next_level() const -> indentation_helper
+{
+   indentation_helper result = *this;
+   ++result.m_current_level;
+   return result;
+}
+
+
+auto cheap::detail::indentation_helper::write_indentation_str(const options& opt, std::string& output) const -> void
+{
+   if(opt.indent_with_tab)
+   {
+      write_repeated_char(m_current_level, '\t', output);
+   }
+   else
+   {
+      write_repeated_char(m_current_level * m_indentation, ' ', output);
    }
 }
 
 
 auto cheap::detail::indentation_helper::is_at_origin() const -> bool
 {
-   return m_current_level == m_initial_level;
+   return m_current_level == m_initial_level;
+}
+
+
+auto cheap::detail::indentation_helper::get_level() const -> int
+{
+   return m_current_level;
+}
+
+
+cheap::detail::indentation_helper::indentation_helper(const options& opt)
+   : m_indentation(opt.indentation)
+   , m_initial_level(opt.initial_level)
+   , m_current_level(m_initial_level)
+{
+   
+}
+
+
+
+auto cheap::get_element_str(
+   const element& elem,
+   const options& opt
+) -> std::string
+{
+   std::string result;
+   write_element_str(elem, result, opt);
+   return result;
+}
+
+auto cheap::get_element_str(
+   const std::vector<element>& elements,
+   const options& opt
+) -> std::string
+{
+   std::string result;
+   write_element_str(elements, result, opt);
+   return result;
+}
+
+
+auto cheap::write_element_str(
+   const element& elem,
+   std::string& output,
+   const options& opt
+) -> void
+{
+   output.clear();
+   detail::write_element_str_impl(elem, detail::indentation_helper(opt), opt, output, nullptr);
+}
+
+
+auto cheap::write_element_str(
+   const std::vector<element>& elements,
+   std::string& output,
+   const options& opt
+) -> void
+{
+   output.clear();
+
+   // Disable ending newlines in between and manually add it at the end if required
+   options intermediate_options = opt;
+   intermediate_options.end_with_newline = false;
+   for(int i=0; i<std::ssize(elements); ++i)
+   {
+      detail::write_element_str_impl(elements[i], detail::indentation_helper(intermediate_options), intermediate_options, output, nullptr);
+      if (i < (std::ssize(elements)-1))
+      {
+         output += '\n';
+      }
+   }
+   if(opt.end_with_newline == true)
+      output += '\n';
+}
+
+
+auto cheap::get_element_str(
+   const element_view& elem,
+   const options& opt
+) -> std::string
+{
+   std::string result;
+   write_element_str(elem, result, opt);
+   return result;
+}
+
+
+auto cheap::write_element_str(
+   const element_view& elem,
+   std::string& output,
+   const options& opt
+) -> void
+{
+   output.clear();
+   detail::write_element_str_impl(elem, detail::indentation_helper(opt), opt, output, nullptr);
+}
+
+
+auto cheap::get_element_str(
+   const element& elem,
+   const template_key key,
+   const options& opt
+) -> std::string
+{
+   std::string result;
+   write_element_str(elem, result, key, opt);
+   return result;
+}
+
+
+auto cheap::get_element_str(
+   const element_view& elem,
+   const template_key key,
+   const options& opt
+) -> std::string
+{
+   std::string result;
+   write_element_str(elem, result, key, opt);
+   return result;
+}
+
+
+auto cheap::write_element_str(
+   const element& elem,
+   std::string& output,
+   const template_key key,
+   const options& opt
+) -> void
+{
+   detail::write_reserved_str(elem, output, key, opt);
+}
+
+
+auto cheap::write_element_str(
+   const element_view& elem,
+   std::string& output,
+   const template_key key,
+   const options& opt
+) -> void
+{
+   detail::write_reserved_str(elem, output, key, opt);
+}
+
+
+auto cheap::get_reservation_statistics(
+   const template_key key
+) -> reservation_statistics
+{
+   const reservation_statistics* reservation = detail::find_reservation(key, false);
+   return reservation != nullptr ? *reservation : reservation_statistics{};
+}
+
+
+auto cheap::detail::find_reservation(
+   const template_key key,
+   const bool is_added
+) -> reservation_statistics*
+{
+   struct string_hash
+   {
+      using is_transparent = void;
+      auto operator()(const std::string_view str) const -> std::size_t { return std::hash<std::string_view>{}(str); }
+   };
+   thread_local std::unordered_map<std::string, reservation_statistics, string_hash, std::equal_to<>> reservations;
+   auto it = reservations.find(key.m_name);
+   if (it == reservations.end())
+   {
+      if (is_added == false)
+         return nullptr;
+      it = reservations.emplace(std::string{ key.m_name }, reservation_statistics{}).first;
+   }
+   return &it->second;
+}
+
+
+template<cheap::detail::element_like element_type>
+auto cheap::detail::write_reserved_str(
+   const element_type& elem,
+   std::string& output,
+   const template_key key,
+   const options& opt
+) -> void
+{
+   reservation_statistics& reservation = *find_reservation(key, true);
+   output.clear();
+   output.reserve(reservation.m_reserved_size);
+   const std::size_t capacity = output.capacity();
+   write_element_str_impl(elem, indentation_helper(opt), opt, output, nullptr);
+   ++reservation.m_render_count;
+   if (output.capacity() > capacity)
+      ++reservation.m_regrowth_count;
+
+   // Grows right away, but only decays slowly so that an occasional small page doesn't cause regrowths
+   if (output.size() >= reservation.m_reserved_size)
+      reservation.m_reserved_size = output.size();
+   else
+      reservation.m_reserved_size -= (reservation.m_reserved_size - output.size()) / 8;
+}
+
+
+auto cheap::scatter_output::clear() -> void
+{
+   m_buffer.clear();
+   m_segments.clear();
+   m_buffer_end = 0;
+}
+
+
+auto cheap::scatter_output::append_reference(const std::string_view str) -> void
+{
+   if (m_buffer.size() > m_buffer_end)
+   {
+      m_segments.push_back(segment{ nullptr, m_buffer_end, m_buffer.size() - m_buffer_end });
+      m_buffer_end = m_buffer.size();
+   }
+   m_segments.push_back(segment{ str.data(), 0, str.size() });
+}
+
+
+auto cheap::scatter_output::get_segments() const -> std::vector<std::string_view>
+{
+   // Buffer pieces are resolved only now, as the buffer may have been reallocated while rendering
+   std::vector<std::string_view> result;
+   result.reserve(m_segments.size() + 1);
+   for (const segment& x : m_segments)
+   {
+      if (x.m_external != nullptr)
+         result.emplace_back(x.m_external, x.m_length);
+      else
+         result.emplace_back(m_buffer.data() + x.m_offset, x.m_length);
+   }
+   if (m_buffer.size() > m_buffer_end)
+      result.emplace_back(m_buffer.data() + m_buffer_end, m_buffer.size() - m_buffer_end);
+   return result;
+}
+
+
+auto cheap::scatter_output::size() const -> std::size_t
+{
+   std::size_t result = m_buffer.size();
+   for (const segment& x : m_segments)
+   {
+      if (x.m_external != nullptr)
+         result += x.m_length;
+   }
+   return result;
+}
+
+
+#ifdef CHEAP_HAS_IOVEC
+auto cheap::scatter_output::get_iovecs() const -> std::vector<iovec>
+{
+   std::vector<iovec> result;
+   for (const std::string_view segment : get_segments())
+      result.push_back(iovec{ const_cast<char*>(segment.data()), segment.size() });
+   return result;
+}
+
+
+auto cheap::scatter_output::write_to(const int file_descriptor) const -> void
+{
+#ifdef IOV_MAX
+   constexpr std::size_t max_count = IOV_MAX;
+#else
+   constexpr std::size_t max_count = 1024;
+#endif
+   std::vector<iovec> iovecs = get_iovecs();
+   std::size_t first = 0;
+   while (first < iovecs.size())
+   {
+      const std::size_t count = std::min(iovecs.size() - first, max_count);
+      const auto written = ::writev(file_descriptor, iovecs.data() + first, static_cast<int>(count));
+      if (written < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         throw cheap_exception{ "Couldn't write the output" };
+      }
+
+      // Skip what was written, a partly written segment continues where it stopped
+      auto remaining = static_cast<std::size_t>(written);
+      while (first < iovecs.size() && remaining >= iovecs[first].iov_len)
+      {
+         remaining -= iovecs[first].iov_len;
+         ++first;
+      }
+      if (remaining > 0)
+      {
+         iovecs[first].iov_base = static_cast<char*>(iovecs[first].iov_base) + remaining;
+         iovecs[first].iov_len -= remaining;
+      }
+      else if (written == 0 && first < iovecs.size())
+      {
+         throw cheap_exception{ "Couldn't write the output" };
+      }
+   }
+}
+#endif
+
+
+auto cheap::write_element_scatter(
+   const element& elem,
+   scatter_output& output,
+   const options& opt
+) -> void
+{
+   output.clear();
+   detail::write_element_str_impl(elem, detail::indentation_helper(opt), opt, output, nullptr);
+}
+
+
+auto cheap::write_element_scatter(
+   const element_view& elem,
+   scatter_output& output,
+   const options& opt
+) -> void
+{
+   output.clear();
+   detail::write_element_str_impl(elem, detail::indentation_helper(opt), opt, output, nullptr);
+}
+
+
+template<cheap::detail::element_like element_type>
+auto cheap::detail::write_stream_impl(
+   const element_type& elem,
+   output_stream& stream,
+   const options& opt,
+   std::string* reused_buffer
+) -> void
+{
+   // A reused buffer is taken while rendering, so nested renders from callbacks get their own
+   stream_output output{ stream, reused_buffer != nullptr ? std::move(*reused_buffer) : std::string{} };
+   output.m_buffer.clear();
+   output.m_buffer.reserve(stream_output::chunk_size);
+   write_element_str_impl(elem, indentation_helper(opt), opt, output, nullptr);
+   output.flush();
+   if (reused_buffer != nullptr)
+      *reused_buffer = std::move(output.m_buffer);
+}
+
+
+auto cheap::write_element_stream(
+   const element& elem,
+   output_stream& stream,
+   const options& opt
+) -> void
+{
+   detail::write_stream_impl(elem, stream, opt);
+}
+
+
+auto cheap::write_element_stream(
+   const element_view& elem,
+   output_stream& stream,
+   const options& opt
+) -> void
+{
+   detail::write_stream_impl(elem, stream, opt);
+}
+
+cheap::render_context::render_context(const options& opt)
+   : m_options(opt)
+{
+
+}
+
+
+template<cheap::detail::element_like element_type>
+auto cheap::detail::render_with_context(
+   render_context& context,
+   const element_type& elem,
+   std::string& output
+) -> void
+{
+   output.clear();
+   output.reserve(context.m_statistics.m_peak_size);
+   const options opt = context.m_options; // Stays the same if a callback renders with the context again
+   const std::size_t replacement_count = utf8_replacement_count;
+   write_element_str_impl(elem, indentation_helper(opt), opt, output, nullptr);
+   context.m_statistics.m_utf8_replacement_count += utf8_replacement_count - replacement_count;
+   ++context.m_statistics.m_render_count;
+   context.m_statistics.m_byte_count += output.size();
+   context.m_statistics.m_peak_size = std::max(context.m_statistics.m_peak_size, output.size());
+}
+
+
+template<cheap::detail::element_like element_type>
+auto cheap::detail::render_with_context(
+   render_context& context,
+   const element_type& elem,
+   output_stream& stream
+) -> void
+{
+   stream_output output{ stream, std::move(context.m_stream_buffer) };
+   output.m_buffer.clear();
+   output.m_buffer.reserve(stream_output::chunk_size);
+   const options opt = context.m_options; // Stays the same if a callback renders with the context again
+   const std::size_t replacement_count = utf8_replacement_count;
+   write_element_str_impl(elem, indentation_helper(opt), opt, output, nullptr);
+   context.m_statistics.m_utf8_replacement_count += utf8_replacement_count - replacement_count;
+   output.flush();
+   context.m_stream_buffer = std::move(output.m_buffer);
+   ++context.m_statistics.m_render_count;
+   context.m_statistics.m_byte_count += output.m_flushed_size;
+   context.m_statistics.m_peak_size = std::max(context.m_statistics.m_peak_size, output.m_flushed_size);
+}
+
+
+auto cheap::render_context::render(
+   const element& elem,
+   std::string& output
+) -> void
+{
+   detail::render_with_context(*this, elem, output);
+}
+
+
+auto cheap::render_context::render(
+   const element_view& elem,
+   std::string& output
+) -> void
+{
+   detail::render_with_context(*this, elem, output);
+}
+
+
+auto cheap::render_context::render(
+   const element& elem,
+   output_stream& stream
+) -> void
+{
+   detail::render_with_context(*this, elem, stream);
+}
+
+
+auto cheap::render_context::render(
+   const element_view& elem,
+   output_stream& stream
+) -> void
+{
+   detail::render_with_context(*this, elem, stream);
+}
+
+
+auto cheap::detail::write_reused_stream(
+   const element& elem,
+   output_stream& stream,
+   const options& opt
+) -> void
+{
+   // Only the chunk buffer is shared by the calls of a thread, so nested calls can't change the options
+   thread_local std::string buffer;
+   write_stream_impl(elem, stream, opt, &buffer);
+}
+
+
+auto cheap::detail::write_reused_stream(
+   const element_view& elem,
+   output_stream& stream,
+   const options& opt
+) -> void
+{
+   // Only the chunk buffer is shared by the calls of a thread, so nested calls can't change the options
+   thread_local std::string buffer;
+   write_stream_impl(elem, stream, opt, &buffer);
+}
+
+auto cheap::batch_statistics::get_bytes_per_second() const -> double
+{
+   if (m_duration.count() <= 0.0)
+      return 0.0;
+   return static_cast<double>(m_byte_count) / m_duration.count();
+}
+
+
+auto cheap::render_batch(
+   const std::span<const element> documents,
+   const options& opt,
+   const batch_output_factory& factory,
+   unsigned thread_count
+) -> batch_statistics
+{
+   const auto start = std::chrono::steady_clock::now();
+   if (thread_count == 0)
+      thread_count = std::max(1u, std::thread::hardware_concurrency());
+   thread_count = static_cast<unsigned>(std::clamp<std::size_t>(documents.size(), 1, thread_count));
+
+   // Every worker starts with an equal range of documents and takes them from the front. When it runs
+   // dry, it steals the back half of what another worker has left. Documents of very different sizes
+   // are balanced that way without a shared counter that all threads contend on
+   struct work_range
+   {
+      std::mutex m_mutex;
+      std::size_t m_begin = 0;
+      std::size_t m_end = 0;
+   };
+   std::vector<work_range> ranges(thread_count);
+   for (unsigned i = 0; i < thread_count; ++i)
+   {
+      ranges[i].m_begin = documents.size() * i / thread_count;
+      ranges[i].m_end = documents.size() * (i + 1) / thread_count;
+   }
+   std::atomic<bool> is_cancelled = false;
+   std::exception_ptr first_exception;
+   std::mutex exception_mutex;
+   std::vector<batch_statistics> worker_statistics(thread_count);
+
+   const auto take_own = [&](const unsigned worker) -> std::optional<std::size_t> {
+      const std::lock_guard lock{ ranges[worker].m_mutex };
+      if (ranges[worker].m_begin == ranges[worker].m_end)
+         return std::nullopt;
+      return ranges[worker].m_begin++;
+   };
+   const auto steal = [&](const unsigned worker) -> bool {
+      for (unsigned offset = 1; offset < thread_count; ++offset)
+      {
+         work_range& victim = ranges[(worker + offset) % thread_count];
+         std::size_t begin = 0;
+         std::size_t end = 0;
+         {
+            const std::lock_guard lock{ victim.m_mutex };
+            if (victim.m_begin == victim.m_end)
+               continue;
+            end = victim.m_end;
+            begin = victim.m_end - (victim.m_end - victim.m_begin + 1) / 2;
+            victim.m_end = begin;
+         }
+         const std::lock_guard lock{ ranges[worker].m_mutex };
+         ranges[worker].m_begin = begin;
+         ranges[worker].m_end = end;
+         return true;
+      }
+      return false;
+   };
+   const auto work = [&](const unsigned worker) {
+      render_context context{ opt };
+      try
+      {
+         while (is_cancelled == false)
+         {
+            const std::optional<std::size_t> index = take_own(worker);
+            if (index.has_value() == false)
+            {
+               if (steal(worker) == false)
+                  break;
+               ++worker_statistics[worker].m_steal_count;
+               continue;
+            }
+            const std::unique_ptr<output_stream> output = factory(*index);
+            if (output == nullptr)
+               throw cheap_exception{ "The batch output factory returned no output" };
+            context.render(documents[*index], *output);
+         }
+      }
+      catch (...)
+      {
+         const std::lock_guard lock{ exception_mutex };
+         if (first_exception == nullptr)
+            first_exception = std::current_exception();
+         is_cancelled = true;
+      }
+      worker_statistics[worker].m_document_count = context.m_statistics.m_render_count;
+      worker_statistics[worker].m_byte_count = context.m_statistics.m_byte_count;
+      worker_statistics[worker].m_utf8_replacement_count = context.m_statistics.m_utf8_replacement_count;
+   };
+
+   {
+      std::vector<std::jthread> threads;
+      threads.reserve(thread_count - 1);
+      for (unsigned i = 1; i < thread_count; ++i)
+         threads.emplace_back(work, i);
+      work(0);
+   }
+   if (first_exception != nullptr)
+      std::rethrow_exception(first_exception);
+
+   batch_statistics result;
+   result.m_thread_count = thread_count;
+   for (const batch_statistics& worker : worker_statistics)
+   {
+      result.m_document_count += worker.m_document_count;
+      result.m_byte_count += worker.m_byte_count;
+      result.m_steal_count += worker.m_steal_count;
+      result.m_utf8_replacement_count += worker.m_utf8_replacement_count;
+   }
+   result.m_duration = std::chrono::steady_clock::now() - start;
+   return result;
+}
+
+
+
+
+auto cheap::write_element_file(
+   const std::string& path,
+   const element& elem,
+   const options& opt
+) -> void
+{
+   struct size_stream final : output_stream
+   {
+      std::size_t m_size = 0;
+      auto write(const std::string_view chunk) -> void override { m_size += chunk.size(); }
+   };
+#ifdef CHEAP_HAS_FALLOCATE
+   struct mapping_stream final : output_stream
+   {
+      char* m_position;
+      char* m_released;
+      char* m_end;
+      auto write(const std::string_view chunk) -> void override
+      {
+         if (chunk.size() > static_cast<std::size_t>(m_end - m_position))
+            throw cheap_exception{ "The element rendered bigger than when its size was measured" };
+         m_position = std::copy(chunk.begin(), chunk.end(), m_position);
+
+         // Written pages stay in the page cache, but are dropped from the process so the memory
+         // use doesn't grow with the file. m_released stays page-aligned as it starts at the mapping
+         constexpr std::size_t release_size = 8 * 1024 * 1024;
+         if (static_cast<std::size_t>(m_position - m_released) >= release_size)
+         {
+            ::madvise(m_released, release_size, MADV_DONTNEED);
+            m_released += release_size;
+         }
+      }
+   };
+#endif
+   struct file_stream final : output_stream
+   {
+      std::FILE* m_file;
+      auto write(const std::string_view chunk) -> void override
+      {
+         if (std::fwrite(chunk.data(), 1, chunk.size(), m_file) != chunk.size())
+            throw cheap_exception{ "Couldn't write to the file" };
+      }
+   };
+
+#ifdef CHEAP_HAS_FALLOCATE
+   // The size is needed up front to size the file, so the element is rendered twice. The space is
+   // allocated instead of only truncated to the size, so a full disk fails here rather than with a
+   // SIGBUS while writing into the mapping
+   size_stream size;
+   write_element_stream(elem, size, opt);
+   const int file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (file == -1)
+      throw cheap_exception{ "Couldn't open the file " + path };
+   void* mapping = MAP_FAILED;
+   if (size.m_size > 0 && ::posix_fallocate(file, 0, static_cast<off_t>(size.m_size)) == 0)
+      mapping = ::mmap(nullptr, size.m_size, PROT_WRITE, MAP_SHARED, file, 0);
+   if (mapping != MAP_FAILED)
+   {
+      mapping_stream memory;
+      memory.m_position = static_cast<char*>(mapping);
+      memory.m_released = memory.m_position;
+      memory.m_end = memory.m_position + size.m_size;
+      try
+      {
+         // Content like callbacks doesn't have to render the same twice
+         write_element_stream(elem, memory, opt);
+         if (memory.m_position != memory.m_end)
+            throw cheap_exception{ "The element rendered smaller than when its size was measured" };
+      }
+      catch (...)
+      {
+         ::munmap(mapping, size.m_size);
+         ::close(file);
+         std::remove(path.c_str());
+         throw;
+      }
+      ::munmap(mapping, size.m_size);
+      ::close(file);
+      return;
+   }
+   ::close(file);
+#endif
+
+   std::FILE* file_handle = std::fopen(path.c_str(), "wb");
+   if (file_handle == nullptr)
+      throw cheap_exception{ "Couldn't open the file " + path };
+   file_stream stream;
+   stream.m_file = file_handle;
+   try
+   {
+      write_element_stream(elem, stream, opt);
+   }
+   catch (...)
+   {
+      // No partially written files are left behind
+      std::fclose(file_handle);
+      std::remove(path.c_str());
+      throw;
+   }
+   if (std::fclose(file_handle) != 0)
+   {
+      std::remove(path.c_str());
+      throw cheap_exception{ "Couldn't write to the file " + path };
+   }
+}
+
+auto cheap::detail::get_crc32(
+   std::uint32_t crc,
+   const std::string_view data
+) -> std::uint32_t
+{
+   static constexpr auto table = [] {
+      std::array<std::uint32_t, 256> result{};
+      for (std::uint32_t i = 0; i < 256; ++i)
+      {
+         std::uint32_t value = i;
+         for (int bit = 0; bit < 8; ++bit)
+            value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+         result[i] = value;
+      }
+      return result;
+   }();
+   crc = ~crc;
+   for (const char ch : data)
+      crc = table[(crc ^ static_cast<unsigned char>(ch)) & 0xFF] ^ (crc >> 8);
+   return ~crc;
+}
+
+
+auto cheap::detail::get_adler32(
+   std::uint32_t adler,
+   const std::string_view data
+) -> std::uint32_t
+{
+   std::uint32_t a = adler & 0xFFFF;
+   std::uint32_t b = adler >> 16;
+   // 5552 is the longest run that can't overflow before the modulo
+   for (std::size_t begin = 0; begin < data.size(); begin += 5552)
+   {
+      for (const char ch : data.substr(begin, 5552))
+      {
+         a += static_cast<unsigned char>(ch);
+         b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+   }
+   return (b << 16) | a;
+}
+
+
+auto cheap::detail::get_huffman_lengths(
+   std::span<const std::uint32_t> frequencies,
+   const int max_length,
+   std::span<std::uint8_t> lengths
+) -> void
+{
+   std::ranges::fill(lengths, std::uint8_t{ 0 });
+   std::vector<std::size_t> symbols;
+   for (std::size_t i = 0; i < frequencies.size(); ++i)
+   {
+      if (frequencies[i] > 0)
+         symbols.push_back(i);
+   }
+   if (symbols.size() < 2)
+   {
+      for (const std::size_t symbol : symbols)
+         lengths[symbol] = 1;
+      return;
+   }
+   std::ranges::stable_sort(symbols, {}, [&](const std::size_t symbol) { return frequencies[symbol]; });
+
+   // Two-queue construction: leaves are sorted, and internal nodes are created in ascending order
+   const std::size_t leaf_count = symbols.size();
+   std::vector<std::uint64_t> weights(2 * leaf_count - 1);
+   std::vector<std::size_t> parents(2 * leaf_count - 1);
+   for (std::size_t i = 0; i < leaf_count; ++i)
+      weights[i] = frequencies[symbols[i]];
+   std::size_t next_leaf = 0;
+   std::size_t next_internal = leaf_count;
+   for (std::size_t node = leaf_count; node < weights.size(); ++node)
+   {
+      const auto pop_lightest = [&] {
+         if (next_leaf < leaf_count && (next_internal == node || weights[next_leaf] <= weights[next_internal]))
+            return next_leaf++;
+         return next_internal++;
+      };
+      const std::size_t first = pop_lightest();
+      const std::size_t second = pop_lightest();
+      weights[node] = weights[first] + weights[second];
+      parents[first] = node;
+      parents[second] = node;
+   }
+
+   // Parents always come after their children, so depths can be computed from the root down
+   std::vector<int> depths(weights.size(), 0);
+   std::vector<int> length_counts(std::max<std::size_t>(leaf_count, max_length + 1), 0);
+   for (std::size_t node = weights.size() - 1; node-- > 0;)
+      depths[node] = depths[parents[node]] + 1;
+   for (std::size_t i = 0; i < leaf_count; ++i)
+      ++length_counts[std::min(depths[i], max_length)];
+
+   // Clamping lengths leaves an oversubscribed code. Leaves are moved down until it's complete again
+   std::uint64_t total = 0;
+   for (int length = 1; length <= max_length; ++length)
+      total += static_cast<std::uint64_t>(length_counts[length]) << (max_length - length);
+   while (total > (std::uint64_t{ 1 } << max_length))
+   {
+      --length_counts[max_length];
+      for (int length = max_length - 1; length > 0; --length)
+      {
+         if (length_counts[length] > 0)
+         {
+            --length_counts[length];
+            length_counts[length + 1] += 2;
+            break;
+         }
+      }
+      --total;
+   }
+
+   // The most frequent symbols get the shortest codes
+   std::size_t symbol_index = leaf_count;
+   for (int length = 1; length <= max_length; ++length)
+   {
+      for (int i = 0; i < length_counts[length]; ++i)
+         lengths[symbols[--symbol_index]] = static_cast<std::uint8_t>(length);
+   }
+}
+
+
+auto cheap::detail::get_huffman_codes(
+   std::span<const std::uint8_t> lengths,
+   std::span<std::uint16_t> codes
+) -> void
+{
+   std::array<std::uint16_t, 16> length_counts{};
+   for (const std::uint8_t length : lengths)
+      ++length_counts[length];
+   length_counts[0] = 0;
+   std::array<std::uint16_t, 16> next_codes{};
+   std::uint16_t code = 0;
+   for (int length = 1; length < 16; ++length)
+   {
+      code = static_cast<std::uint16_t>((code + length_counts[length - 1]) << 1);
+      next_codes[length] = code;
+   }
+   for (std::size_t i = 0; i < lengths.size(); ++i)
+   {
+      if (lengths[i] == 0)
+         continue;
+      // Deflate writes codes starting with the most significant bit, but bits are written LSB first
+      const std::uint16_t value = next_codes[lengths[i]]++;
+      std::uint16_t reversed = 0;
+      for (int bit = 0; bit < lengths[i]; ++bit)
+         reversed = static_cast<std::uint16_t>(reversed | (((value >> bit) & 1) << (lengths[i] - 1 - bit)));
+      codes[i] = reversed;
+   }
+}
+
+
+namespace cheap::detail
+{
+   constexpr std::uint16_t length_bases[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+   constexpr std::uint8_t length_extra_bits[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+   constexpr std::uint16_t distance_bases[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+   constexpr std::uint8_t distance_extra_bits[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+   constexpr std::uint8_t code_length_order[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+   constexpr std::size_t deflate_window_size = 32768;
+   constexpr std::size_t deflate_block_size = 32768;
+   constexpr std::size_t deflate_hash_size = 32768;
+}
+
+
+auto cheap::detail::get_length_code(const std::size_t length) -> int
+{
+   return static_cast<int>(std::ranges::upper_bound(length_bases, length) - std::begin(length_bases)) - 1;
+}
+
+
+auto cheap::detail::get_distance_code(const std::size_t distance) -> int
+{
+   return static_cast<int>(std::ranges::upper_bound(distance_bases, distance) - std::begin(distance_bases)) - 1;
+}
+
+
+cheap::compress_stream::compress_stream(
+   output_stream& target,
+   const int level,
+   const compression_format format
+)
+   : m_target(target)
+   , m_format(format)
+   , m_hash_heads(detail::deflate_hash_size, 0)
+   , m_hash_chains(detail::deflate_window_size, 0)
+   , m_checksum(format == compression_format::gzip ? 0 : 1)
+{
+   struct level_parameters { int m_max_chain; std::size_t m_nice_length; bool m_lazy; };
+   constexpr level_parameters parameters[] = {
+      { 0, 0, false }, { 4, 8, false }, { 8, 16, false }, { 16, 32, false }, { 16, 32, true },
+      { 32, 64, true }, { 128, 128, true }, { 256, 258, true }, { 1024, 258, true }, { 4096, 258, true }
+   };
+   if (level < 0 || level > 9)
+      throw cheap_exception{ "Compression levels go from 0 to 9" };
+   m_max_chain = parameters[level].m_max_chain;
+   m_nice_length = parameters[level].m_nice_length;
+   m_lazy = parameters[level].m_lazy;
+
+   if (m_format == compression_format::gzip)
+   {
+      // Deflate, no flags, no modification time, unknown OS
+      constexpr char header[] = { '\x1F', '\x8B', 8, 0, 0, 0, 0, 0, 0, '\xFF' };
+      m_output.append(header, sizeof(header));
+   }
+   else
+   {
+      // Deflate with a 32K window. The level hint and check bits make the header a multiple of 31
+      const int level_hint = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+      const int header = (0x78 << 8) | (level_hint << 6);
+      m_output += static_cast<char>(header >> 8);
+      m_output += static_cast<char>((header | (31 - header % 31)) & 0xFF);
+   }
+}
+
+
+cheap::compress_stream::~compress_stream()
+{
+   assert((m_is_finished || std::uncaught_exceptions() > 0) && "compress_stream::finish() wasn't called, the output is incomplete");
+}
+
+
+auto cheap::compress_stream::write(const std::string_view chunk) -> void
+{
+   m_checksum = m_format == compression_format::gzip ? detail::get_crc32(m_checksum, chunk) : detail::get_adler32(m_checksum, chunk);
+   m_input_size += static_cast<std::uint32_t>(chunk.size()); // gzip stores the size modulo 2^32
+   m_input += chunk;
+   while (m_input.size() - m_pending >= detail::deflate_block_size)
+   {
+      compress_block(m_pending + detail::deflate_block_size, false);
+
+      // Only the window is kept as history
+      if (m_pending > detail::deflate_window_size)
+      {
+         const std::size_t dropped = m_pending - detail::deflate_window_size;
+         m_input.erase(0, dropped);
+         m_pending -= dropped;
+         m_input_base += dropped;
+      }
+   }
+   if (m_output.size() >= detail::stream_output::chunk_size)
+   {
+      m_target.write(m_output);
+      m_output.clear();
+   }
+}
+
+
+auto cheap::compress_stream::finish() -> void
+{
+   compress_block(m_input.size(), true);
+   align_bits();
+
+   const auto write_trailer_number = [&](const std::uint32_t number, const bool big_endian) {
+      for (int i = 0; i < 4; ++i)
+         m_output += static_cast<char>((number >> (big_endian ? 24 - 8 * i : 8 * i)) & 0xFF);
+   };
+   if (m_format == compression_format::gzip)
+   {
+      write_trailer_number(m_checksum, false);
+      write_trailer_number(m_input_size, false);
+   }
+   else
+   {
+      write_trailer_number(m_checksum, true);
+   }
+   m_target.write(m_output);
+   m_output.clear();
+   m_is_finished = true;
+}
+
+
+auto cheap::compress_stream::insert_hash(const std::size_t position) -> void
+{
+   const auto byte = [&](const std::size_t i) { return static_cast<std::uint32_t>(static_cast<unsigned char>(m_input[i])); };
+   const std::size_t hash = ((byte(position) << 10) ^ (byte(position + 1) << 5) ^ byte(position + 2)) % detail::deflate_hash_size;
+   const std::uint64_t absolute_position = m_input_base + position;
+   m_hash_chains[absolute_position % detail::deflate_window_size] = m_hash_heads[hash];
+   m_hash_heads[hash] = absolute_position + 1;
+}
+
+
+auto cheap::compress_stream::find_match(
+   const std::size_t position,
+   const std::size_t end
+) const -> lz_symbol
+{
+   lz_symbol result{ static_cast<std::uint16_t>(static_cast<unsigned char>(m_input[position])), 0 };
+   if (m_max_chain == 0 || position + 3 > end)
+      return result;
+
+   const auto byte = [&](const std::size_t i) { return static_cast<std::uint32_t>(static_cast<unsigned char>(m_input[i])); };
+   const std::size_t hash = ((byte(position) << 10) ^ (byte(position + 1) << 5) ^ byte(position + 2)) % detail::deflate_hash_size;
+   const std::uint64_t absolute_position = m_input_base + position;
+   const std::size_t max_length = std::min<std::size_t>(258, end - position);
+   std::size_t best_length = 0;
+   std::uint64_t candidate_entry = m_hash_heads[hash];
+   for (int chain = 0; chain < m_max_chain && candidate_entry != 0; ++chain)
+   {
+      // Entries are stored plus one, so that zero means empty
+      const std::uint64_t candidate = candidate_entry - 1;
+      const std::uint64_t distance = absolute_position - candidate;
+      if (distance > detail::deflate_window_size)
+         break;
+      const std::size_t candidate_position = static_cast<std::size_t>(candidate - m_input_base);
+      if (m_input[candidate_position + best_length] == m_input[position + best_length])
+      {
+         std::size_t length = 0;
+         while (length + 8 <= max_length)
+         {
+            std::uint64_t candidate_bytes;
+            std::uint64_t bytes;
+            std::memcpy(&candidate_bytes, m_input.data() + candidate_position + length, 8);
+            std::memcpy(&bytes, m_input.data() + position + length, 8);
+            if (candidate_bytes != bytes)
+               break;
+            length += 8;
+         }
+         while (length < max_length && m_input[candidate_position + length] == m_input[position + length])
+            ++length;
+         if (length > best_length)
+         {
+            best_length = length;
+            result.m_distance = static_cast<std::uint16_t>(distance);
+            if (length >= m_nice_length || length == max_length)
+               break;
+         }
+      }
+      candidate_entry = m_hash_chains[candidate % detail::deflate_window_size];
+   }
+
+   // Short matches far away cost more than the literals
+   if (best_length < 3 || (best_length == 3 && result.m_distance > 4096))
+      return lz_symbol{ static_cast<std::uint16_t>(static_cast<unsigned char>(m_input[position])), 0 };
+   result.m_literal_or_length = static_cast<std::uint16_t>(best_length);
+   return result;
+}
+
+
+auto cheap::compress_stream::write_bits(
+   const std::uint32_t bits,
+   const int count
+) -> void
+{
+   m_bit_buffer |= static_cast<std::uint64_t>(bits) << m_bit_count;
+   m_bit_count += count;
+   if (m_bit_count >= 32)
+   {
+      const char bytes[] = {
+         static_cast<char>(m_bit_buffer & 0xFF), static_cast<char>((m_bit_buffer >> 8) & 0xFF),
+         static_cast<char>((m_bit_buffer >> 16) & 0xFF), static_cast<char>((m_bit_buffer >> 24) & 0xFF)
+      };
+      m_output.append(bytes, 4);
+      m_bit_buffer >>= 32;
+      m_bit_count -= 32;
+   }
+}
+
+
+auto cheap::compress_stream::align_bits() -> void
+{
+   if (m_bit_count % 8 != 0)
+      write_bits(0, 8 - m_bit_count % 8);
+   for (; m_bit_count > 0; m_bit_count -= 8)
+   {
+      m_output += static_cast<char>(m_bit_buffer & 0xFF);
+      m_bit_buffer >>= 8;
+   }
+}
+
+
+auto cheap::compress_stream::write_symbols(
+   std::span<const std::uint8_t> lengths,
+   std::span<const std::uint16_t> codes,
+   std::span<const std::uint8_t> distance_lengths,
+   std::span<const std::uint16_t> distance_codes
+) -> void
+{
+   for (const lz_symbol& symbol : m_symbols)
+   {
+      if (symbol.m_distance == 0)
+      {
+         write_bits(codes[symbol.m_literal_or_length], lengths[symbol.m_literal_or_length]);
+         continue;
+      }
+      const int length_code = detail::get_length_code(symbol.m_literal_or_length);
+      write_bits(codes[257 + length_code], lengths[257 + length_code]);
+      write_bits(symbol.m_literal_or_length - detail::length_bases[length_code], detail::length_extra_bits[length_code]);
+      const int distance_code = detail::get_distance_code(symbol.m_distance);
+      write_bits(distance_codes[distance_code], distance_lengths[distance_code]);
+      write_bits(symbol.m_distance - detail::distance_bases[distance_code], detail::distance_extra_bits[distance_code]);
+   }
+   write_bits(codes[256], lengths[256]);
+}
+
+
+auto cheap::compress_stream::write_stored_block(
+   const std::size_t end,
+   const bool is_final
+) -> void
+{
+   const std::size_t block_size = end - m_pending;
+   write_bits(is_final ? 1 : 0, 3);
+   align_bits();
+   write_bits(static_cast<std::uint32_t>(block_size), 16);
+   write_bits(static_cast<std::uint32_t>(~block_size & 0xFFFF), 16);
+   align_bits();
+   m_output.append(m_input, m_pending, block_size);
+}
+
+
+auto cheap::compress_stream::compress_block(
+   const std::size_t end,
+   const bool is_final
+) -> void
+{
+   const std::size_t begin = m_pending;
+   if (m_max_chain == 0)
+   {
+      write_stored_block(end, is_final);
+      m_pending = end;
+      return;
+   }
+
+   // LZ77 with hash chains. Lazy matching defers a match if the next position has a longer one
+   m_symbols.clear();
+   std::size_t position = begin;
+   lz_symbol match = position < end ? find_match(position, end) : lz_symbol{};
+   while (position < end)
+   {
+      if (position + 3 <= end)
+         insert_hash(position);
+      lz_symbol next_match{};
+      const bool has_next = position + 1 < end;
+      if (has_next && m_lazy && match.m_distance != 0 && match.m_literal_or_length < m_nice_length)
+      {
+         next_match = find_match(position + 1, end);
+         if (next_match.m_distance != 0 && next_match.m_literal_or_length > match.m_literal_or_length)
+         {
+            m_symbols.push_back(lz_symbol{ static_cast<std::uint16_t>(static_cast<unsigned char>(m_input[position])), 0 });
+            ++position;
+            match = next_match;
+            continue;
+         }
+      }
+      if (match.m_distance != 0)
+      {
+         m_symbols.push_back(match);
+         // Faster levels don't index the inside of long matches
+         if (m_lazy || match.m_literal_or_length <= m_nice_length)
+         {
+            for (std::size_t i = position + 1; i < position + match.m_literal_or_length && i + 3 <= end; ++i)
+               insert_hash(i);
+         }
+         position += match.m_literal_or_length;
+      }
+      else
+      {
+         m_symbols.push_back(match);
+         ++position;
+      }
+      if (position < end)
+         match = find_match(position, end);
+   }
+
+   // Symbol statistics
+   std::array<std::uint32_t, 286> frequencies{};
+   std::array<std::uint32_t, 30> distance_frequencies{};
+   std::uint64_t extra_bits = 0;
+   for (const lz_symbol& symbol : m_symbols)
+   {
+      if (symbol.m_distance == 0)
+      {
+         ++frequencies[symbol.m_literal_or_length];
+         continue;
+      }
+      const int length_code = detail::get_length_code(symbol.m_literal_or_length);
+      const int distance_code = detail::get_distance_code(symbol.m_distance);
+      ++frequencies[257 + length_code];
+      ++distance_frequencies[distance_code];
+      extra_bits += detail::length_extra_bits[length_code] + detail::distance_extra_bits[distance_code];
+   }
+   frequencies[256] = 1;
+
+   // Dynamic codes. Every code gets at least two symbols, as some decoders reject a single one
+   const auto get_lengths = [](auto frequencies_copy, const int max_length, std::span<std::uint8_t> lengths) {
+      for (std::size_t i = 0; std::ranges::count_if(frequencies_copy, [](const std::uint32_t x) { return x > 0; }) < 2; ++i)
+         frequencies_copy[i] = std::max<std::uint32_t>(frequencies_copy[i], 1);
+      detail::get_huffman_lengths(frequencies_copy, max_length, lengths);
+   };
+   std::array<std::uint8_t, 286> lengths{};
+   std::array<std::uint8_t, 30> distance_lengths{};
+   get_lengths(frequencies, 15, lengths);
+   get_lengths(distance_frequencies, 15, distance_lengths);
+   std::size_t length_count = 286;
+   while (length_count > 257 && lengths[length_count - 1] == 0)
+      --length_count;
+   std::size_t distance_count = 30;
+   while (distance_count > 1 && distance_lengths[distance_count - 1] == 0)
+      --distance_count;
+
+   // The code lengths are run-length encoded with the symbols 16 (repeat), 17 and 18 (zeros)
+   std::vector<std::uint8_t> all_lengths(lengths.begin(), lengths.begin() + length_count);
+   all_lengths.insert(all_lengths.end(), distance_lengths.begin(), distance_lengths.begin() + distance_count);
+   std::vector<std::pair<std::uint8_t, std::uint8_t>> length_symbols; // Symbol and the value of its extra bits
+   for (std::size_t i = 0; i < all_lengths.size();)
+   {
+      const std::uint8_t value = all_lengths[i];
+      std::size_t run = 1;
+      while (i + run < all_lengths.size() && all_lengths[i + run] == value)
+         ++run;
+      i += run;
+      if (value == 0)
+      {
+         for (; run >= 11; run -= std::min<std::size_t>(run, 138))
+            length_symbols.emplace_back(18, static_cast<std::uint8_t>(std::min<std::size_t>(run, 138) - 11));
+         if (run >= 3)
+         {
+            length_symbols.emplace_back(17, static_cast<std::uint8_t>(run - 3));
+            run = 0;
+         }
+      }
+      else
+      {
+         length_symbols.emplace_back(value, 0);
+         --run;
+         for (; run >= 3; run -= std::min<std::size_t>(run, 6))
+            length_symbols.emplace_back(16, static_cast<std::uint8_t>(std::min<std::size_t>(run, 6) - 3));
+      }
+      for (; run > 0; --run)
+         length_symbols.emplace_back(value, 0);
+   }
+   std::array<std::uint32_t, 19> code_length_frequencies{};
+   for (const auto& [symbol, extra] : length_symbols)
+      ++code_length_frequencies[symbol];
+   std::array<std::uint8_t, 19> code_length_lengths{};
+   get_lengths(code_length_frequencies, 7, code_length_lengths);
+   std::size_t code_length_count = 19;
+   while (code_length_count > 4 && code_length_lengths[detail::code_length_order[code_length_count - 1]] == 0)
+      --code_length_count;
+
+   // The cheapest of the dynamic, fixed and stored encodings is used
+   constexpr std::uint8_t length_symbol_extra_bits[] = { 2, 3, 7 };
+   std::uint64_t dynamic_bits = 3 + 14 + 3 * code_length_count + extra_bits;
+   for (const auto& [symbol, extra] : length_symbols)
+      dynamic_bits += code_length_lengths[symbol] + (symbol >= 16 ? length_symbol_extra_bits[symbol - 16] : 0);
+   std::array<std::uint8_t, 288> fixed_lengths{};
+   std::array<std::uint8_t, 30> fixed_distance_lengths{};
+   std::ranges::fill(fixed_lengths, std::uint8_t{ 8 });
+   std::fill(fixed_lengths.begin() + 144, fixed_lengths.begin() + 256, std::uint8_t{ 9 });
+   std::fill(fixed_lengths.begin() + 256, fixed_lengths.begin() + 280, std::uint8_t{ 7 });
+   std::ranges::fill(fixed_distance_lengths, std::uint8_t{ 5 });
+   std::uint64_t fixed_bits = 3 + extra_bits;
+   for (std::size_t i = 0; i < frequencies.size(); ++i)
+   {
+      dynamic_bits += static_cast<std::uint64_t>(frequencies[i]) * lengths[i];
+      fixed_bits += static_cast<std::uint64_t>(frequencies[i]) * fixed_lengths[i];
+   }
+   for (std::size_t i = 0; i < distance_frequencies.size(); ++i)
+   {
+      dynamic_bits += static_cast<std::uint64_t>(distance_frequencies[i]) * distance_lengths[i];
+      fixed_bits += static_cast<std::uint64_t>(distance_frequencies[i]) * fixed_distance_lengths[i];
+   }
+   const std::size_t block_size = end - begin;
+   const std::uint64_t stored_bits = 3 + (8 - (m_bit_count + 3) % 8) % 8 + 32 + 8 * static_cast<std::uint64_t>(block_size);
+
+   if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits)
+   {
+      write_stored_block(end, is_final);
+   }
+   else if (fixed_bits <= dynamic_bits)
+   {
+      std::array<std::uint16_t, 288> fixed_codes{};
+      std::array<std::uint16_t, 30> fixed_distance_codes{};
+      detail::get_huffman_codes(fixed_lengths, fixed_codes);
+      detail::get_huffman_codes(fixed_distance_lengths, fixed_distance_codes);
+      write_bits((is_final ? 1 : 0) | (1 << 1), 3);
+      write_symbols(fixed_lengths, fixed_codes, fixed_distance_lengths, fixed_distance_codes);
+   }
+   else
+   {
+      std::array<std::uint16_t, 286> codes{};
+      std::array<std::uint16_t, 30> distance_codes{};
+      std::array<std::uint16_t, 19> code_length_codes{};
+      detail::get_huffman_codes(lengths, codes);
+      detail::get_huffman_codes(distance_lengths, distance_codes);
+      detail::get_huffman_codes(code_length_lengths, code_length_codes);
+      write_bits((is_final ? 1 : 0) | (2 << 1), 3);
+      write_bits(static_cast<std::uint32_t>(length_count - 257), 5);
+      write_bits(static_cast<std::uint32_t>(distance_count - 1), 5);
+      write_bits(static_cast<std::uint32_t>(code_length_count - 4), 4);
+      for (std::size_t i = 0; i < code_length_count; ++i)
+         write_bits(code_length_lengths[detail::code_length_order[i]], 3);
+      for (const auto& [symbol, extra] : length_symbols)
+      {
+         write_bits(code_length_codes[symbol], code_length_lengths[symbol]);
+         if (symbol >= 16)
+            write_bits(extra, length_symbol_extra_bits[symbol - 16]);
+      }
+      write_symbols(lengths, codes, distance_lengths, distance_codes);
+   }
+   m_pending = end;
+}
+
+namespace cheap::detail
+{
+   constexpr std::uint64_t xxh64_primes[] = { 0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x85EBCA77C2B2AE63ull, 0x27D4EB2F165667C5ull };
+}
+
+
+auto cheap::detail::read_little_endian(
+   const unsigned char* data,
+   const int size
+) -> std::uint64_t
+{
+   std::uint64_t result = 0;
+   for (int i = size - 1; i >= 0; --i)
+      result = (result << 8) | data[i];
+   return result;
+}
+
+
+auto cheap::detail::xxh64_round(
+   std::uint64_t accumulator,
+   const std::uint64_t input
+) -> std::uint64_t
+{
+   accumulator += input * xxh64_primes[1];
+   return std::rotl(accumulator, 31) * xxh64_primes[0];
+}
+
+
+auto cheap::xxh64_hasher::update(const std::string_view data) -> void
+{
+   const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+   std::size_t size = data.size();
+   m_total_size += size;
+   const auto consume_block = [&](const unsigned char* block) {
+      for (int i = 0; i < 4; ++i)
+         m_accumulators[i] = detail::xxh64_round(m_accumulators[i], detail::read_little_endian(block + 8 * i, 8));
+   };
+   if (m_block_size > 0)
+   {
+      const std::size_t count = std::min(size, 32 - m_block_size);
+      std::copy_n(bytes, count, m_block + m_block_size);
+      m_block_size += count;
+      bytes += count;
+      size -= count;
+      if (m_block_size < 32)
+         return;
+      consume_block(m_block);
+      m_block_size = 0;
+   }
+   for (; size >= 32; bytes += 32, size -= 32)
+      consume_block(bytes);
+   std::copy_n(bytes, size, m_block);
+   m_block_size = size;
+}
+
+
+auto cheap::xxh64_hasher::get_digest() const -> std::uint64_t
+{
+   using detail::xxh64_primes;
+   std::uint64_t result;
+   if (m_total_size >= 32)
+   {
+      result = std::rotl(m_accumulators[0], 1) + std::rotl(m_accumulators[1], 7) + std::rotl(m_accumulators[2], 12) + std::rotl(m_accumulators[3], 18);
+      for (const std::uint64_t accumulator : m_accumulators)
+         result = (result ^ detail::xxh64_round(0, accumulator)) * xxh64_primes[0] + xxh64_primes[3];
+   }
+   else
+   {
+      result = m_accumulators[2] + xxh64_primes[4]; // The seed
+   }
+   result += m_total_size;
+
+   std::size_t i = 0;
+   for (; i + 8 <= m_block_size; i += 8)
+      result = std::rotl(result ^ detail::xxh64_round(0, detail::read_little_endian(m_block + i, 8)), 27) * xxh64_primes[0] + xxh64_primes[3];
+   if (i + 4 <= m_block_size)
+   {
+      result = std::rotl(result ^ (detail::read_little_endian(m_block + i, 4) * xxh64_primes[0]), 23) * xxh64_primes[1] + xxh64_primes[2];
+      i += 4;
+   }
+   for (; i < m_block_size; ++i)
+      result = std::rotl(result ^ (m_block[i] * xxh64_primes[4]), 11) * xxh64_primes[0];
+
+   result ^= result >> 33;
+   result *= xxh64_primes[1];
+   result ^= result >> 29;
+   result *= xxh64_primes[2];
+   result ^= result >> 32;
+   return result;
+}
+
+
+namespace cheap::detail
+{
+   constexpr std::uint32_t sha256_constants[] = {
+      0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+      0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+      0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+      0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+      0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+      0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+      0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+      0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+   };
+}
+
+
+auto cheap::detail::sha256_compress(
+   std::uint32_t (&state)[8],
+   const unsigned char* block
+) -> void
+{
+   std::uint32_t schedule[64];
+   for (int i = 0; i < 16; ++i)
+      schedule[i] = (std::uint32_t{ block[4 * i] } << 24) | (std::uint32_t{ block[4 * i + 1] } << 16) | (std::uint32_t{ block[4 * i + 2] } << 8) | block[4 * i + 3];
+   for (int i = 16; i < 64; ++i)
+   {
+      const std::uint32_t s0 = std::rotr(schedule[i - 15], 7) ^ std::rotr(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+      const std::uint32_t s1 = std::rotr(schedule[i - 2], 17) ^ std::rotr(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+      schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+   }
+   std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+   for (int i = 0; i < 64; ++i)
+   {
+      const std::uint32_t t1 = h + (std::rotr(e, 6) ^ std::rotr(e, 11) ^ std::rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256_constants[i] + schedule[i];
+      const std::uint32_t t2 = (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+   }
+   state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+   state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+
+auto cheap::sha256_hasher::update(const std::string_view data) -> void
+{
+   const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+   std::size_t size = data.size();
+   m_total_size += size;
+   if (m_block_size > 0)
+   {
+      const std::size_t count = std::min(size, 64 - m_block_size);
+      std::copy_n(bytes, count, m_block + m_block_size);
+      m_block_size += count;
+      bytes += count;
+      size -= count;
+      if (m_block_size < 64)
+         return;
+      detail::sha256_compress(m_state, m_block);
+      m_block_size = 0;
+   }
+   for (; size >= 64; bytes += 64, size -= 64)
+      detail::sha256_compress(m_state, bytes);
+   std::copy_n(bytes, size, m_block);
+   m_block_size = size;
+}
+
+
+auto cheap::sha256_hasher::get_digest() const -> std::array<std::uint8_t, 32>
+{
+   // Padding: a one bit, zeros and the size in bits, filling up the last block
+   sha256_hasher final_state = *this;
+   const std::uint64_t bit_size = m_total_size * 8;
+   const unsigned char one_bit = 0x80;
+   final_state.update(std::string_view{ reinterpret_cast<const char*>(&one_bit), 1 });
+   const unsigned char zeros[64]{};
+   final_state.update(std::string_view{ reinterpret_cast<const char*>(zeros), (64 + 56 - final_state.m_block_size) % 64 });
+   unsigned char size_bytes[8];
+   for (int i = 0; i < 8; ++i)
+      size_bytes[i] = static_cast<unsigned char>(bit_size >> (56 - 8 * i));
+   final_state.update(std::string_view{ reinterpret_cast<const char*>(size_bytes), 8 });
+
+   std::array<std::uint8_t, 32> result{};
+   for (int i = 0; i < 32; ++i)
+      result[i] = static_cast<std::uint8_t>(final_state.m_state[i / 4] >> (24 - 8 * (i % 4)));
+   return result;
+}
+
+
+auto cheap::content_hash::get_etag() const -> std::string
+{
+   constexpr char digits[] = "0123456789abcdef";
+   std::string result = "\"";
+   for (int shift = 60; shift >= 0; shift -= 4)
+      result += digits[(m_xxh64 >> shift) & 0xF];
+   result += '"';
+   return result;
+}
+
+
+cheap::hash_stream::hash_stream(
+   output_stream* target,
+   const bool with_sha256
+)
+   : m_target(target)
+   , m_with_sha256(with_sha256)
+{
+
+}
+
+
+auto cheap::hash_stream::write(const std::string_view chunk) -> void
+{
+   m_xxh64.update(chunk);
+   if (m_with_sha256)
+      m_sha256.update(chunk);
+   if (m_target != nullptr)
+      m_target->write(chunk);
+}
+
+
+auto cheap::hash_stream::get_hash() const -> content_hash
+{
+   content_hash result;
+   result.m_xxh64 = m_xxh64.get_digest();
+   if (m_with_sha256)
+      result.m_sha256 = m_sha256.get_digest();
+   return result;
+}
+
+
+auto cheap::write_element_str(
+   const element& elem,
+   std::string& output,
+   content_hash& hash,
+   const options& opt,
+   const bool with_sha256
+) -> void
+{
+   struct string_stream final : output_stream
+   {
+      std::string& m_output;
+      explicit string_stream(std::string& output) : m_output(output) {}
+      auto write(const std::string_view chunk) -> void override { m_output += chunk; }
+   };
+   output.clear();
+   string_stream target{ output };
+   hash_stream hasher{ &target, with_sha256 };
+   write_element_stream(elem, hasher, opt);
+   hash = hasher.get_hash();
+}
+
+auto cheap::detail::get_table_element(const column_table& table) -> element
+{
+   const std::size_t row_count = get_row_count(table);
+   element result{ "table", table.m_attributes, {} };
+   if (table.m_header.empty() == false)
+   {
+      element header_row{ "tr" };
+      for (const std::string& title : table.m_header)
+         header_row.m_inner_html.emplace_back(element{ "th", { title } });
+      result.m_inner_html.emplace_back(element{ "thead", { std::move(header_row) } });
+   }
+   if (table.m_columns.empty() == false)
+   {
+      element body{ "tbody" };
+      body.m_inner_html.reserve(row_count);
+      for (std::size_t row = 0; row < row_count; ++row)
+      {
+         element table_row{ "tr" };
+         for (std::size_t i = 0; i < table.m_columns.size(); ++i)
+         {
+            element cell{ "td", table.m_column_attributes.empty() ? std::vector<attribute>{} : table.m_column_attributes[i], {} };
+            std::visit([&]<typename T>(const std::span<const T>& column) {
+               if constexpr (std::same_as<T, int>)
+                  cell.m_inner_html.emplace_back(static_cast<long long>(column[row]));
+               else if constexpr (std::same_as<T, std::string_view>)
+                  cell.m_inner_html.emplace_back(std::string{ column[row] });
+               else
+                  cell.m_inner_html.emplace_back(column[row]);
+            }, table.m_columns[i]);
+            table_row.m_inner_html.emplace_back(std::move(cell));
+         }
+         body.m_inner_html.emplace_back(std::move(table_row));
+      }
+      result.m_inner_html.emplace_back(std::move(body));
+   }
+   return result;
+}
+
+
+auto cheap::get_snapshot(const element& elem) -> std::string
+{
+   std::vector<snapshot::node> nodes;
+   std::vector<snapshot::attribute_record> attributes;
+   std::string strings;
+
+   // Short strings like names repeat a lot, so they are only stored once
+   std::unordered_map<std::string_view, std::uint64_t> short_strings;
+   std::deque<std::string> short_string_storage;
+   const auto add_string = [&](const std::string_view str) -> std::uint64_t {
+      if (str.size() > 64)
+      {
+         strings += str;
+         return strings.size() - str.size();
+      }
+      if (const auto it = short_strings.find(str); it != short_strings.end())
+         return it->second;
+      strings += str;
+      short_strings.emplace(short_string_storage.emplace_back(str), strings.size() - str.size());
+      return strings.size() - str.size();
+   };
+   const auto get_length = [](const std::string_view str) {
+      if (str.size() > std::numeric_limits<std::uint32_t>::max())
+         throw cheap_exception{ "Snapshot strings are limited to 4 GiB" };
+      return static_cast<std::uint32_t>(str.size());
+   };
+
+   // Breadth-first, elements are queued when their node is added. Tables are converted to elements
+   std::vector<std::pair<const element*, std::uint32_t>> queue;
+   std::deque<element> table_elements;
+   const auto add_element_node = [&](const element& child) {
+      snapshot::node& result = nodes.emplace_back();
+      result.m_kind = snapshot::node_kind::element;
+      result.m_string_offset = add_string(child.m_name);
+      result.m_string_length = get_length(child.m_name);
+      result.m_first_attribute = static_cast<std::uint32_t>(attributes.size());
+      result.m_attribute_count = static_cast<std::uint32_t>(child.m_attributes.size());
+      for (const attribute& attrib : child.m_attributes)
+      {
+         snapshot::attribute_record& record = attributes.emplace_back();
+         std::visit([&]<typename T>(const T& alternative) {
+            record.m_name_offset = add_string(alternative.m_name);
+            record.m_name_length = get_length(alternative.m_name);
+            if constexpr (std::same_as<T, bool_attribute>)
+            {
+               record.m_kind = alternative.m_value ? snapshot::attribute_kind::bool_true : snapshot::attribute_kind::bool_false;
+            }
+            else
+            {
+               record.m_kind = snapshot::attribute_kind::string;
+               record.m_value_offset = add_string(alternative.m_value);
+               record.m_value_length = get_length(alternative.m_value);
+            }
+         }, attrib);
+      }
+      queue.emplace_back(&child, static_cast<std::uint32_t>(nodes.size() - 1));
+   };
+   add_element_node(elem);
+   for (std::size_t i = 0; i < queue.size(); ++i)
+   {
+      const auto [parent, parent_index] = queue[i];
+      nodes[parent_index].m_first_child = static_cast<std::uint32_t>(nodes.size());
+      nodes[parent_index].m_child_count = static_cast<std::uint32_t>(parent->m_inner_html.size());
+      for (const content& child : parent->m_inner_html)
+      {
+         std::visit([&]<typename T>(const T& alternative) {
+            if constexpr (std::same_as<T, element>)
+            {
+               add_element_node(alternative);
+            }
+            else if constexpr (std::same_as<T, column_table>)
+            {
+               add_element_node(table_elements.emplace_back(detail::get_table_element(alternative)));
+            }
+            else if constexpr (std::same_as<T, html_callback>)
+            {
+               throw cheap_exception{ "Callback content can't be stored in a snapshot" };
+            }
+            else
+            {
+               std::string text;
+               detail::write_text_str(alternative, options{ .escaping = false }, text);
+               snapshot::node& result = nodes.emplace_back();
+               result.m_kind = detail::is_any_of<T, std::string, cheap::text> ? snapshot::node_kind::text : snapshot::node_kind::verbatim;
+               result.m_string_offset = add_string(text);
+               result.m_string_length = get_length(text);
+            }
+         }, child);
+      }
+      if (nodes.size() > std::numeric_limits<std::uint32_t>::max() || attributes.size() > std::numeric_limits<std::uint32_t>::max())
+         throw cheap_exception{ "Snapshots are limited to 2^32 nodes and attributes" };
+   }
+
+   snapshot::header header{};
+   std::copy_n("CHEAPSNP", 8, header.m_magic);
+   header.m_version = 1;
+   header.m_node_count = static_cast<std::uint32_t>(nodes.size());
+   header.m_attribute_count = static_cast<std::uint32_t>(attributes.size());
+   header.m_nodes_offset = sizeof(header);
+   header.m_attributes_offset = header.m_nodes_offset + nodes.size() * sizeof(snapshot::node);
+   header.m_strings_offset = header.m_attributes_offset + attributes.size() * sizeof(snapshot::attribute_record);
+   header.m_strings_size = strings.size();
+
+   std::string result;
+   result.reserve(header.m_strings_offset + strings.size());
+   result.append(reinterpret_cast<const char*>(&header), sizeof(header));
+   result.append(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(snapshot::node));
+   result.append(reinterpret_cast<const char*>(attributes.data()), attributes.size() * sizeof(snapshot::attribute_record));
+   result += strings;
+   return result;
+}
+
+
+cheap::snapshot::snapshot(const std::string_view data)
+   : m_data(data)
+{
+   // The records are read as they are, which is only the stored layout on little-endian machines
+   if constexpr (std::endian::native != std::endian::little)
+      throw cheap_exception{ "Snapshots are only supported on little-endian machines" };
+   if (m_data.size() < sizeof(header))
+      throw cheap_exception{ "The snapshot is too small" };
+   std::memcpy(&m_header, m_data.data(), sizeof(header));
+   if (std::string_view{ m_header.m_magic, 8 } != "CHEAPSNP" || m_header.m_version != 1)
+      throw cheap_exception{ "The data is not a supported snapshot" };
+   if (m_header.m_node_count == 0
+      || m_header.m_nodes_offset + std::uint64_t{ m_header.m_node_count } * sizeof(node) > m_data.size()
+      || m_header.m_attributes_offset + std::uint64_t{ m_header.m_attribute_count } * sizeof(attribute_record) > m_data.size()
+      || m_header.m_strings_offset > m_data.size()
+      || m_header.m_strings_size > m_data.size() - m_header.m_strings_offset)
+   {
+      throw cheap_exception{ "The snapshot is corrupt" };
+   }
+}
+
+
+auto cheap::snapshot::open_file(const std::string& path) -> snapshot
+{
+#ifdef CHEAP_HAS_MMAP
+   const int file = ::open(path.c_str(), O_RDONLY);
+   if (file == -1)
+      throw cheap_exception{ "Couldn't open the file " + path };
+   struct stat status{};
+   void* mapping = MAP_FAILED;
+   if (::fstat(file, &status) == 0 && status.st_size > 0)
+      mapping = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+   ::close(file);
+   if (mapping != MAP_FAILED)
+   {
+      try
+      {
+         snapshot result{ std::string_view{ static_cast<const char*>(mapping), static_cast<std::size_t>(status.st_size) } };
+         result.m_mapping = mapping;
+         return result;
+      }
+      catch (...)
+      {
+         ::munmap(mapping, static_cast<std::size_t>(status.st_size));
+         throw;
+      }
+   }
+#endif
+
+   std::FILE* file_handle = std::fopen(path.c_str(), "rb");
+   if (file_handle == nullptr)
+      throw cheap_exception{ "Couldn't open the file " + path };
+   std::string contents;
+   char buffer[64 * 1024];
+   for (std::size_t count; (count = std::fread(buffer, 1, sizeof(buffer), file_handle)) > 0;)
+      contents.append(buffer, count);
+   std::fclose(file_handle);
+   snapshot result{ contents };
+   result.m_owned = std::move(contents);
+   result.m_data = result.m_owned;
+   return result;
+}
+
+
+cheap::snapshot::snapshot(snapshot&& other) noexcept
+   : m_data(other.m_data)
+   , m_header(other.m_header)
+   , m_owned(std::move(other.m_owned))
+   , m_mapping(std::exchange(other.m_mapping, nullptr))
+{
+   if (m_owned.empty() == false)
+      m_data = m_owned;
+}
+
+
+auto cheap::snapshot::operator=(snapshot&& other) noexcept -> snapshot&
+{
+   if (this != &other)
+   {
+      this->~snapshot();
+      new (this) snapshot(std::move(other));
+   }
+   return *this;
+}
+
+
+cheap::snapshot::~snapshot()
+{
+#ifdef CHEAP_HAS_MMAP
+   if (m_mapping != nullptr)
+      ::munmap(m_mapping, m_data.size());
+#endif
+}
+
+
+auto cheap::snapshot::get_node(const std::uint32_t index) const -> node
+{
+   if (index >= m_header.m_node_count)
+      throw cheap_exception{ "The snapshot is corrupt" };
+   node result;
+   std::memcpy(&result, m_data.data() + m_header.m_nodes_offset + std::uint64_t{ index } * sizeof(node), sizeof(node));
+   return result;
+}
+
+
+auto cheap::snapshot::get_attribute(const std::uint32_t index) const -> attribute_record
+{
+   if (index >= m_header.m_attribute_count)
+      throw cheap_exception{ "The snapshot is corrupt" };
+   attribute_record result;
+   std::memcpy(&result, m_data.data() + m_header.m_attributes_offset + std::uint64_t{ index } * sizeof(attribute_record), sizeof(attribute_record));
+   return result;
+}
+
+
+auto cheap::snapshot::get_string(
+   const std::uint64_t offset,
+   const std::uint32_t length
+) const -> std::string_view
+{
+   if (offset > m_header.m_strings_size || length > m_header.m_strings_size - offset)
+      throw cheap_exception{ "The snapshot is corrupt" };
+   return m_data.substr(m_header.m_strings_offset + offset, length);
+}
+
+
+template<typename output_type>
+auto cheap::detail::write_snapshot_node(
+   const snapshot& snap,
+   const std::uint32_t index,
+   const indentation_helper& indentation,
+   const options& opt,
+   output_type& target,
+   const escape_context context
+) -> void
+{
+   // Same output as write_element_str_impl
+   std::string& output = get_buffer(target);
+   const snapshot::node node = snap.get_node(index);
+   const std::string_view str = snap.get_string(node.m_string_offset, node.m_string_length);
+   const auto write_text = [&](const snapshot::node& text_node, const std::string_view text, const escape_context text_context) {
+      if (text_node.m_kind == snapshot::node_kind::text)
+         write_text_str(text, opt, output, text_context);
+      else
+         output += text;
+   };
+   if (node.m_kind != snapshot::node_kind::element)
+   {
+      indentation.write_indentation_str(opt, output);
+      write_text(node, str, context);
+      return;
+   }
+   // Children always come after their parent, which also rules out cycles in corrupt data
+   if (node.m_child_count > 0 && node.m_first_child <= index)
+      throw cheap_exception{ "The snapshot is corrupt" };
+
+   indentation.write_indentation_str(opt, output);
+   output += '<';
+   output += str;
+   for (std::uint32_t i = 0; i < node.m_attribute_count; ++i)
+   {
+      const snapshot::attribute_record record = snap.get_attribute(node.m_first_attribute + i);
+      const std::string_view name = snap.get_string(record.m_name_offset, record.m_name_length);
+      if (record.m_kind == snapshot::attribute_kind::string)
+         write_attribute_string(string_attribute_view{ name, snap.get_string(record.m_value_offset, record.m_value_length) }, output, opt);
+      else
+         write_attribute_string(bool_attribute_view{ name, record.m_kind == snapshot::attribute_kind::bool_true }, output, opt);
+   }
+
+   const bool is_trivial = node.m_child_count == 0
+      || (node.m_child_count == 1 && snap.get_node(node.m_first_child).m_kind != snapshot::node_kind::element);
+   if (is_in(void_elements, str))
+   {
+      if (node.m_child_count > 0)
+      {
+         std::string msg = "The used element (\"";
+         msg += str;
+         msg += "\") is self-closing and can't have children";
+         throw cheap_exception{ msg };
+      }
+      output += " /";
+   }
+   else if (is_trivial)
+   {
+      output += '>';
+      if (node.m_child_count == 1)
+      {
+         const snapshot::node child = snap.get_node(node.m_first_child);
+         write_text(child, snap.get_string(child.m_string_offset, child.m_string_length), get_content_context(str));
+      }
+      output += "</";
+      output += str;
+   }
+   else
+   {
+      output += ">\n";
+      for (std::uint32_t i = 0; i < node.m_child_count; ++i)
+      {
+         if (i > 0)
+            output += '\n';
+         write_snapshot_node(snap, node.m_first_child + i, indentation.get_next_level(), opt, target, get_content_context(str));
+         flush_if_full(target);
+      }
+      output += '\n';
+      indentation.write_indentation_str(opt, output);
+      output += "</";
+      output += str;
+   }
+
+   output += '>';
+   if (indentation.is_at_origin() && opt.end_with_newline)
+      output += '\n';
+}
+
+
+auto cheap::get_snapshot_str(
+   const snapshot& snap,
+   const options& opt
+) -> std::string
+{
+   std::string result;
+   write_snapshot_str(snap, result, opt);
+   return result;
+}
+
+
+auto cheap::write_snapshot_str(
+   const snapshot& snap,
+   std::string& output,
+   const options& opt
+) -> void
+{
+   output.clear();
+   detail::write_snapshot_node(snap, 0, detail::indentation_helper(opt), opt, output);
+}
+
+
+auto cheap::write_snapshot_stream(
+   const snapshot& snap,
+   output_stream& stream,
+   const options& opt
+) -> void
+{
+   detail::stream_output output{ stream, {} };
+   detail::write_snapshot_node(snap, 0, detail::indentation_helper(opt), opt, output);
+   output.flush();
+}
+
+auto cheap::detail::find_either(
+   const std::string_view str,
+   std::size_t pos,
+   const char first,
+   const char second
+) -> std::size_t
+{
+   // Eight bytes at a time: a byte of x ^ pattern is zero where it matches, and the classic
+   // (v - 0x01..) & ~v & 0x80.. test flags the lowest zero byte reliably
+   if constexpr (std::endian::native == std::endian::little)
+   {
+      constexpr std::uint64_t ones = 0x0101010101010101ull;
+      constexpr std::uint64_t highs = 0x8080808080808080ull;
+      const std::uint64_t first_pattern = ones * static_cast<unsigned char>(first);
+      const std::uint64_t second_pattern = ones * static_cast<unsigned char>(second);
+      for (; pos + 8 <= str.size(); pos += 8)
+      {
+         std::uint64_t word;
+         std::memcpy(&word, str.data() + pos, 8);
+         const std::uint64_t a = word ^ first_pattern;
+         const std::uint64_t b = word ^ second_pattern;
+         const std::uint64_t found = ((a - ones) & ~a & highs) | ((b - ones) & ~b & highs);
+         if (found != 0)
+            return pos + std::countr_zero(found) / 8;
+      }
+   }
+   for (; pos < str.size(); ++pos)
+   {
+      if (str[pos] == first || str[pos] == second)
+         return pos;
+   }
+   return std::string_view::npos;
+}
+
+
+auto cheap::detail::append_decoded(
+   const std::string_view str,
+   std::string& output
+) -> void
+{
+   std::size_t run_begin = 0;
+   for (std::size_t pos = str.find('&'); pos != std::string_view::npos; pos = str.find('&', run_begin))
+   {
+      output += str.substr(run_begin, pos - run_begin);
+      run_begin = pos + 1;
+      const std::size_t end = str.find(';', pos);
+      if (end == std::string_view::npos || end - pos > 10)
+      {
+         output += '&';
+         continue;
+      }
+      const std::string_view name = str.substr(pos + 1, end - pos - 1);
+      char32_t code_point = 0;
+      if (name == "amp")       code_point = '&';
+      else if (name == "lt")   code_point = '<';
+      else if (name == "gt")   code_point = '>';
+      else if (name == "quot") code_point = '"';
+      else if (name == "apos") code_point = '\'';
+      else if (name == "nbsp") code_point = 0xA0;
+      else if (name.size() > 1 && name[0] == '#')
+      {
+         const bool is_hex = name[1] == 'x' || name[1] == 'X';
+         const std::string_view digits = name.substr(is_hex ? 2 : 1);
+         std::uint32_t value = 0;
+         const auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value, is_hex ? 16 : 10);
+         if (ec == std::errc{} && ptr == digits.data() + digits.size() && value > 0 && value <= 0x10FFFF && (value < 0xD800 || value > 0xDFFF))
+            code_point = value;
+      }
+      if (code_point == 0)
+      {
+         // Unknown references stay as they are
+         output += '&';
+         continue;
+      }
+      if (code_point < 0x80)
+      {
+         output += static_cast<char>(code_point);
+      }
+      else if (code_point < 0x800)
+      {
+         output += static_cast<char>(0xC0 | (code_point >> 6));
+         output += static_cast<char>(0x80 | (code_point & 0x3F));
+      }
+      else if (code_point < 0x10000)
+      {
+         output += static_cast<char>(0xE0 | (code_point >> 12));
+         output += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+         output += static_cast<char>(0x80 | (code_point & 0x3F));
+      }
+      else
+      {
+         output += static_cast<char>(0xF0 | (code_point >> 18));
+         output += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+         output += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+         output += static_cast<char>(0x80 | (code_point & 0x3F));
+      }
+      run_begin = end + 1;
+   }
+   output += str.substr(run_begin);
+}
+
+
+auto cheap::parse_html(const std::string_view html) -> std::vector<element>
+{
+   constexpr std::string_view whitespace = " \t\n\r\f";
+   const auto is_name_end = [](const char ch) {
+      return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '/' || ch == '>' || ch == '=';
+   };
+   const auto throw_malformed = [&](const std::size_t pos, const std::string_view what) {
+      std::string msg = "Malformed HTML at offset ";
+      msg += std::to_string(pos);
+      msg += ": ";
+      msg += what;
+      throw cheap_exception{ msg };
+   };
+
+   // One pass over a text or attribute value finds its end and whether it has character references
+   const auto find_text_end = [&](const std::size_t begin, const char end, bool& has_reference) {
+      std::size_t found = detail::find_either(html, begin, end, '&');
+      while (found != std::string_view::npos && html[found] == '&')
+      {
+         has_reference = true;
+         found = detail::find_either(html, found + 1, end, '&');
+      }
+      return found;
+   };
+
+   std::vector<element> result;
+   std::vector<element> open_elements;
+   const auto add_content = [&](content&& child, const std::size_t pos) {
+      if (open_elements.empty())
+      {
+         if (std::holds_alternative<element>(child) == false)
+            throw_malformed(pos, "text outside of elements");
+         result.emplace_back(std::move(std::get<element>(child)));
+      }
+      else
+      {
+         open_elements.back().m_inner_html.emplace_back(std::move(child));
+      }
+   };
+
+   std::size_t pos = 0;
+   while (pos < html.size())
+   {
+      bool has_reference = false;
+      const std::size_t tag_begin = find_text_end(pos, '<', has_reference);
+      const std::size_t text_end = tag_begin == std::string_view::npos ? html.size() : tag_begin;
+
+      // Text between tags, without the surrounding whitespace
+      const std::size_t first = html.find_first_not_of(whitespace, pos);
+      if (first < text_end)
+      {
+         const std::size_t last = html.find_last_not_of(whitespace, text_end - 1);
+         const std::string_view text = html.substr(first, last + 1 - first);
+         std::string decoded;
+         if (has_reference == false)
+            decoded = text;
+         else
+            detail::append_decoded(text, decoded);
+         add_content(std::move(decoded), first);
+      }
+      if (tag_begin == std::string_view::npos)
+         break;
+      pos = tag_begin + 1;
+
+      if (html.substr(pos, 3) == "!--")
+      {
+         const std::size_t end = html.find("-->", pos + 3);
+         if (end == std::string_view::npos)
+            throw_malformed(tag_begin, "unterminated comment");
+         pos = end + 3;
+         continue;
+      }
+      if (pos < html.size() && (html[pos] == '!' || html[pos] == '?'))
+      {
+         const std::size_t end = html.find('>', pos);
+         if (end == std::string_view::npos)
+            throw_malformed(tag_begin, "unterminated declaration");
+         pos = end + 1;
+         continue;
+      }
+
+      if (pos < html.size() && html[pos] == '/')
+      {
+         const std::size_t end = html.find('>', pos);
+         if (end == std::string_view::npos)
+            throw_malformed(tag_begin, "unterminated end tag");
+         const std::size_t name_end = html.find_last_not_of(whitespace, end - 1) + 1;
+         const std::string_view name = html.substr(pos + 1, name_end - pos - 1);
+         if (open_elements.empty() || open_elements.back().m_name != name)
+            throw_malformed(tag_begin, "unexpected end tag");
+         element closed = std::move(open_elements.back());
+         open_elements.pop_back();
+         add_content(std::move(closed), tag_begin);
+         pos = end + 1;
+         continue;
+      }
+
+      // Start tag
+      std::size_t name_end = pos;
+      while (name_end < html.size() && is_name_end(html[name_end]) == false)
+         ++name_end;
+      if (name_end == pos || name_end == html.size())
+         throw_malformed(tag_begin, "invalid tag");
+      element elem{ html.substr(pos, name_end - pos) };
+      pos = name_end;
+      bool is_closed = false;
+      while (true)
+      {
+         pos = html.find_first_not_of(whitespace, pos);
+         if (pos == std::string_view::npos)
+            throw_malformed(tag_begin, "unterminated tag");
+         if (html[pos] == '>')
+         {
+            ++pos;
+            break;
+         }
+         if (html.substr(pos, 2) == "/>")
+         {
+            is_closed = true;
+            pos += 2;
+            break;
+         }
+         const std::size_t attrib_begin = pos;
+         while (pos < html.size() && is_name_end(html[pos]) == false)
+            ++pos;
+         if (pos == attrib_begin)
+            throw_malformed(pos, "invalid attribute");
+         const std::string_view name = html.substr(attrib_begin, pos - attrib_begin);
+         const std::size_t equal_pos = html.find_first_not_of(whitespace, pos);
+         if (equal_pos == std::string_view::npos || html[equal_pos] != '=')
+         {
+            elem.m_attributes.emplace_back(bool_attribute{ std::string{ name }, true });
+            continue;
+         }
+         pos = html.find_first_not_of(whitespace, equal_pos + 1);
+         if (pos == std::string_view::npos)
+            throw_malformed(attrib_begin, "missing attribute value");
+         std::string_view value;
+         bool has_reference = true;
+         if (html[pos] == '"' || html[pos] == '\'')
+         {
+            has_reference = false;
+            const std::size_t value_end = find_text_end(pos + 1, html[pos], has_reference);
+            if (value_end == std::string_view::npos)
+               throw_malformed(attrib_begin, "unterminated attribute value");
+            value = html.substr(pos + 1, value_end - pos - 1);
+            pos = value_end + 1;
+         }
+         else
+         {
+            // Unquoted values only end at whitespace or '>', so URLs like /news/1 are values as a whole
+            const std::size_t value_begin = pos;
+            pos = std::min(html.find_first_of(" \t\n\r\f>", pos), html.size());
+            value = html.substr(value_begin, pos - value_begin);
+         }
+         string_attribute attrib{ std::string{ name }, {} };
+         if (has_reference)
+            detail::append_decoded(value, attrib.m_value);
+         else
+            attrib.m_value = value;
+         elem.m_attributes.emplace_back(std::move(attrib));
+      }
+
+      if (is_closed || elem.is_self_closing())
+      {
+         add_content(std::move(elem), tag_begin);
+      }
+      else if (elem.m_name == "script" || elem.m_name == "style")
+      {
+         // Raw text up to the end tag
+         const std::string end_tag = "</" + elem.m_name;
+         const std::size_t end = html.find(end_tag, pos);
+         const std::size_t end_close = end == std::string_view::npos ? end : html.find('>', end);
+         if (end_close == std::string_view::npos)
+            throw_malformed(tag_begin, "unterminated raw text element");
+         const std::size_t first_content = html.find_first_not_of(whitespace, pos);
+         if (first_content < end)
+         {
+            const std::size_t last_content = html.find_last_not_of(whitespace, end - 1);
+            elem.m_inner_html.emplace_back(raw_html{ std::string{ html.substr(first_content, last_content + 1 - first_content) } });
+         }
+         add_content(std::move(elem), tag_begin);
+         pos = end_close + 1;
+      }
+      else
+      {
+         open_elements.emplace_back(std::move(elem));
+      }
+   }
+   if (open_elements.empty() == false)
+   {
+      std::string msg = "Malformed HTML: element \"";
+      msg += open_elements.back().m_name;
+      msg += "\" is not closed";
+      throw cheap_exception{ msg };
+   }
+   return result;
+}
+
+
+
+
+
+
+auto cheap::write_element_str(
+   const element& elem,
+   std::string& output,
+   render_map& map,
+   const options& opt
+) -> void
+{
+   output.clear();
+   map = render_map{};
+   detail::write_element_str_impl(elem, detail::indentation_helper(opt), opt, output, &map);
+}
+
+
+auto cheap::get_diff(
+   const element& before,
+   const element& after
+) -> std::vector<content_path>
+{
+   std::vector<content_path> changes;
+   content_path path;
+   detail::collect_changes(before, after, path, changes);
+   return changes;
+}
+
+
+auto cheap::rewrite_element_str(
+   const element& after,
+   const std::vector<content_path>& changes,
+   std::string& output,
+   render_map& map,
+   const options& opt
+) -> void
+{
+   for(const content_path& path : changes)
+   {
+      // A changed root can't be patched
+      if(path.empty())
+      {
+         write_element_str(after, output, map, opt);
+         return;
+      }
+      detail::rewrite_content(after, path, output, map, opt);
+   }
+}
+
+
+auto cheap::get_patch_str(
+   const element& before,
+   const element& after,
+   const options& opt
+) -> std::string
+{
+   std::string result;
+   write_patch_str(before, after, result, opt);
+   return result;
+}
+
+
+auto cheap::write_patch_str(
+   const element& before,
+   const element& after,
+   std::string& output,
+   const options& opt
+) -> void
+{
+   output.clear();
+   output += '[';
+   content_path path;
+   if (before.m_name != after.m_name)
+   {
+      detail::write_patch_head("replace", path, output);
+      detail::write_patch_html(after, opt, output);
+      output += '}';
+   }
+   else
+      detail::write_patches(before, after, path, opt, output);
+   output += ']';
+}
+
+cheap::element::element(
+   const std::string_view name,
+   std::vector<attribute> attributes,
+   std::vector<content> inner_html
+)
+   : m_name(name)
+   , m_attributes(std::move(attributes))
+   , m_inner_html(std::move(inner_html))
+{ }
+cheap::element::element(const std::string_view name, std::vector<content> inner_html)
+   : element(name, {}, std::move(inner_html))
+{ }
+cheap::element::element(const std::string_view name)
+   : element(name, {}, {})
+{ }
+cheap::element::element(const element& other) = default;
+cheap::element::element(element&& other) noexcept = default;
+auto cheap::element::operator=(const element& other) -> element& = default;
+auto cheap::element::operator=(element&& other) noexcept -> element& = default;
+cheap::element::~element() = default;
+
+auto cheap::detail::make_element(
+   const std::string_view name,
+   std::initializer_list<element_param> params
+) -> element
+{
+   element result{ name };
+   add_element_params(result, std::span<const element_param>(params.begin(), params.size()));
+   if (result.m_name.empty())
+   {
+      throw cheap_exception{ "No name set" };
+   }
+   return result;
+}
+
+
+auto cheap::detail::add_element_params(
+   element& result,
+   const std::span<const element_param> params
+) -> void
+{
+   using kind = element_param::kind;
+   const auto is_attribute_param = [](const element_param& param) {
+      return param.m_kind == kind::attribute || param.m_kind == kind::bool_attribute || param.m_kind == kind::string_attribute;
+   };
+   const auto attribute_count = std::ranges::count_if(params, is_attribute_param);
+   result.m_attributes.reserve(attribute_count);
+   result.m_inner_html.reserve(params.size() - attribute_count);
+
+   // Rvalue arguments were non-const, so moving from them is fine
+   const auto add = []<typename T>(auto& target, const element_param& param, std::type_identity<T>) {
+      const T& value = *static_cast<const T*>(param.m_ptr);
+      if (param.m_is_rvalue)
+         target.emplace_back(std::move(const_cast<T&>(value)));
+      else
+         target.emplace_back(value);
+   };
+   for (const element_param& param : params)
+   {
+      switch (param.m_kind)
+      {
+      case kind::element:
+         add(result.m_inner_html, param, std::type_identity<element>{});
+         break;
+      case kind::attribute:
+         add(result.m_attributes, param, std::type_identity<attribute>{});
+         break;
+      case kind::bool_attribute:
+         add(result.m_attributes, param, std::type_identity<bool_attribute>{});
+         break;
+      case kind::string_attribute:
+         add(result.m_attributes, param, std::type_identity<string_attribute>{});
+         break;
+      case kind::raw_html:
+         add(result.m_inner_html, param, std::type_identity<raw_html>{});
+         break;
+      case kind::escaped_text:
+         add(result.m_inner_html, param, std::type_identity<escaped_text>{});
+         break;
+      case kind::cached_text:
+         add(result.m_inner_html, param, std::type_identity<text>{});
+         break;
+      case kind::signed_number:
+         result.m_inner_html.emplace_back(param.m_signed);
+         break;
+      case kind::unsigned_number:
+         result.m_inner_html.emplace_back(param.m_unsigned);
+         break;
+      case kind::floating_number:
+         result.m_inner_html.emplace_back(param.m_floating);
+         break;
+      case kind::date_time:
+         result.m_inner_html.emplace_back(date_time{ std::chrono::seconds{ param.m_signed } });
+         break;
+      case kind::column_table:
+         add(result.m_inner_html, param, std::type_identity<column_table>{});
+         break;
+      case kind::html_callback:
+         add(result.m_inner_html, param, std::type_identity<html_callback>{});
+         break;
+      case kind::string:
+      case kind::text:
+      {
+         const std::string_view text = param.m_kind == kind::text ? param.m_text : *static_cast<const std::string*>(param.m_ptr);
+         // string as first parameter -> element name
+         if (result.m_name.empty())
+            result.m_name = text;
+         else if (param.m_kind == kind::string)
+            add(result.m_inner_html, param, std::type_identity<std::string>{});
+         else
+            result.m_inner_html.emplace_back(std::string{ text });
+         break;
+      }
+      }
+   }
+}
+
+
+auto cheap::element::is_trivial() const -> bool
+{
+   if (m_inner_html.empty())
+      return true;
+
+   return m_inner_html.size() == 1
+      && std::holds_alternative<element>(m_inner_html.front()) == false
+      && std::holds_alternative<column_table>(m_inner_html.front()) == false
+      && std::holds_alternative<html_callback>(m_inner_html.front()) == false;
+}
+
+auto cheap::element::get_trivial(const options& opt) const -> std::string
+{
+   std::string result;
+   if (m_inner_html.empty() == false)
+      std::visit([&]<typename T>(const T& x) { if constexpr (detail::text_like<T>) detail::write_text_str(x, opt, result, detail::get_content_context(m_name)); }, m_inner_html.front());
+   return result;
+}
+
+auto cheap::element::is_self_closing() const -> bool
+{
+   return detail::is_self_closing(m_name);
+}
+
+cheap::element_view::element_view(
+   const std::string_view name,
+   std::vector<attribute_view> attributes,
+   std::vector<content_view> inner_html
+)
+   : m_name(name)
+   , m_attributes(std::move(attributes))
+   , m_inner_html(std::move(inner_html))
+{
+#ifdef CHEAP_CHECK_VIEWS
+   std::tie(m_debug_identity, m_debug_checksum) = detail::get_view_hashes(*this);
+#endif
+}
+cheap::element_view::element_view(const std::string_view name, std::vector<content_view> inner_html)
+   : element_view(name, {}, std::move(inner_html))
+{ }
+cheap::element_view::element_view(const std::string_view name)
+   : element_view(name, {}, {})
+{ }
+
+auto cheap::element_view::is_trivial() const -> bool
+{
+   if (m_inner_html.empty())
+      return true;
+
+   return m_inner_html.size() == 1 && std::holds_alternative<std::string_view>(m_inner_html.front());
+}
+
+auto cheap::element_view::get_trivial(const options& opt) const -> std::string
+{
+   std::string result;
+   if (m_inner_html.empty() == false)
+      detail::write_text_str(std::get<std::string_view>(m_inner_html.front()), opt, result, detail::get_content_context(m_name));
+   return result;
+}
+
+auto cheap::element_view::is_self_closing() const -> bool
+{
+   return detail::is_self_closing(m_name);
+}
+
+cheap::string_pool::string_pool(const bool is_shared)
+   : m_is_shared(is_shared)
+{
+
+}
+
+
+auto cheap::string_pool::pair_hash::operator()(const std::pair<const char*, const char*>& key) const -> std::size_t
+{
+   const std::size_t first = std::hash<const char*>{}(key.first);
+   return first ^ (std::hash<const char*>{}(key.second) + 0x9E3779B97F4A7C15ull + (first << 6) + (first >> 2));
+}
+
+
+auto cheap::string_pool::intern_locked(const std::string_view str) -> std::string_view
+{
+   // Empty strings all share one view, which can't be confused with a missing value
+   if (str.empty())
+      return std::string_view{ "", 0 };
+   if (const auto it = m_strings.find(str); it != m_strings.end())
+      return *it;
+
+   // Strings are packed into chunks, big ones get their own
+   char* target = nullptr;
+   if (str.size() > chunk_size / 4)
+   {
+      target = m_chunks.emplace_back(std::make_unique_for_overwrite<char[]>(str.size())).get();
+   }
+   else
+   {
+      if (m_chunk_left < str.size())
+      {
+         m_chunk = m_chunks.emplace_back(std::make_unique_for_overwrite<char[]>(chunk_size)).get();
+         m_chunk_left = chunk_size;
+      }
+      target = m_chunk;
+      m_chunk += str.size();
+      m_chunk_left -= str.size();
+   }
+   std::copy(str.begin(), str.end(), target);
+   m_byte_count += str.size();
+   return *m_strings.emplace(target, str.size()).first;
+}
+
+
+auto cheap::string_pool::intern(const std::string_view str) -> std::string_view
+{
+   std::unique_lock<std::mutex> lock{ m_mutex, std::defer_lock };
+   if (m_is_shared)
+      lock.lock();
+   return intern_locked(str);
+}
+
+
+auto cheap::string_pool::get_attribute(const std::string_view str) -> attribute_view
+{
+   std::unique_lock<std::mutex> lock{ m_mutex, std::defer_lock };
+   if (m_is_shared)
+      lock.lock();
+   const std::size_t equal_pos = str.find('=');
+   const std::string_view name = intern_locked(str.substr(0, equal_pos));
+   const std::string_view value = equal_pos == std::string_view::npos ? std::string_view{} : intern_locked(str.substr(equal_pos + 1));
+
+   // Interned strings are identical if their pointers are, so the check is only done once per attribute
+   if (m_valid_attributes.contains({ name.data(), value.data() }) == false)
+   {
+      if (equal_pos == std::string_view::npos)
+         detail::assert_attrib_valid(bool_attribute{ std::string{ name } });
+      else
+         detail::assert_attrib_valid(string_attribute{ std::string{ name }, std::string{ value } });
+      m_valid_attributes.emplace(name.data(), value.data());
+   }
+   if (equal_pos == std::string_view::npos)
+      return bool_attribute_view{ name };
+   return string_attribute_view{ name, value };
+}
+
+
+auto cheap::string_pool::get_string_count() const -> std::size_t
+{
+   std::unique_lock<std::mutex> lock{ m_mutex, std::defer_lock };
+   if (m_is_shared)
+      lock.lock();
+   return m_strings.size();
+}
+
+
+auto cheap::string_pool::get_byte_count() const -> std::size_t
+{
+   std::unique_lock<std::mutex> lock{ m_mutex, std::defer_lock };
+   if (m_is_shared)
+      lock.lock();
+   return m_byte_count;
+}
+
+cheap::text::text(std::string str)
+   : m_text(std::move(str))
+{
+
+}
+
+cheap::text::text(const text& other)
+   : m_text(other.m_text)
+{
+   copy_cache(other);
+}
+
+cheap::text::text(text&& other) noexcept
+   : m_text(std::move(other.m_text))
+{
+   take_cache(other);
+}
+
+auto cheap::text::operator=(const text& other) -> text&
+{
+   if (this != &other)
+   {
+      set(other.m_text);
+      copy_cache(other);
+   }
+   return *this;
+}
+
+auto cheap::text::operator=(text&& other) noexcept -> text&
+{
+   if (this != &other)
+   {
+      set(std::move(other.m_text));
+      take_cache(other);
+   }
+   return *this;
+}
+
+auto cheap::text::set(std::string str) -> void
+{
+   m_text = std::move(str);
+   m_state.store(cache_state::empty, std::memory_order_relaxed);
+   m_escaped.clear();
+   m_replacement_count = 0;
+}
+
+auto cheap::text::get_cached(const std::uint8_t key) const -> std::optional<std::string_view>
+{
+   if (m_state.load(std::memory_order_acquire) != cache_state::ready || m_key != key)
+      return std::nullopt;
+   return m_escaped.empty() ? std::string_view{ m_text } : std::string_view{ m_escaped };
+}
+
+auto cheap::text::set_cached(const std::uint8_t key, const std::string_view escaped, const std::size_t replacement_count) const -> void
+{
+   // Only the first render fills the cache, concurrent ones just don't use it yet
+   cache_state expected = cache_state::empty;
+   if (m_state.compare_exchange_strong(expected, cache_state::writing, std::memory_order_acquire) == false)
+      return;
+   m_key = key;
+   if (escaped != m_text)
+      m_escaped = escaped;
+   m_replacement_count = replacement_count;
+   m_state.store(cache_state::ready, std::memory_order_release);
+}
+
+auto cheap::text::copy_cache(const text& other) -> void
+{
+   if (other.m_state.load(std::memory_order_acquire) != cache_state::ready)
+      return;
+   m_key = other.m_key;
+   m_escaped = other.m_escaped;
+   m_replacement_count = other.m_replacement_count;
+   m_state.store(cache_state::ready, std::memory_order_release);
+}
+
+cheap::html_writer::html_writer(std::string& output, const options& opt)
+   : html_writer(output, opt, detail::escape_context::text)
+{
+
+}
+
+cheap::html_writer::html_writer(output_stream& stream, const options& opt)
+   : m_options(opt)
+   , m_own_stream(new detail::stream_output{ stream, {} })
+   , m_stream(m_own_stream.get())
+   , m_output(m_stream->m_buffer)
+   , m_root_context(detail::escape_context::text)
+{
+   m_output.reserve(detail::stream_output::chunk_size);
+}
+
+cheap::html_writer::html_writer(std::string& output, const options& opt, const detail::escape_context root_context)
+   : m_options(opt)
+   , m_output(output)
+   , m_root_context(root_context)
+{
+
+}
+
+cheap::html_writer::html_writer(detail::stream_output& output, const options& opt, const detail::escape_context root_context)
+   : m_options(opt)
+   , m_stream(&output)
+   , m_output(output.m_buffer)
+   , m_root_context(root_context)
+{
+
+}
+
+cheap::html_writer::~html_writer() = default;
+
+auto cheap::html_writer::open(const std::string_view name) -> html_writer&
+{
+   begin_child(false);
+   m_output += '<';
+   m_output += name;
+   m_open_elements.push_back({ .m_name = std::string{ name }, .m_is_self_closing = detail::is_self_closing(name) });
+   return *this;
+}
+
+auto cheap::html_writer::attr(const std::string_view name) -> html_writer&
+{
+   return attr(bool_attribute{ std::string{ name } });
+}
+
+auto cheap::html_writer::attr(const std::string_view name, const std::string_view value) -> html_writer&
+{
+   return attr(string_attribute{ std::string{ name }, std::string{ value } });
+}
+
+auto cheap::html_writer::attr(const attribute& attrib) -> html_writer&
+{
+   if (m_open_elements.empty() || m_open_elements.back().m_is_start_tag_open == false)
+      throw cheap_exception{ "Attributes have to be written right after the element is opened" };
+   detail::assert_attrib_valid(attrib);
+   detail::write_attribute_string(attrib, m_output, m_options);
+   return *this;
+}
+
+auto cheap::html_writer::text(const std::string_view str) -> html_writer&
+{
+   begin_child(true);
+   // Text in script and style is raw text there
+   const detail::escape_context context = m_open_elements.empty() ? m_root_context : detail::get_content_context(m_open_elements.back().m_name);
+   detail::write_text_str(str, m_options, m_output, context);
+   flush_if_full();
+   return *this;
+}
+
+auto cheap::html_writer::text(const raw_html& html) -> html_writer&
+{
+   begin_child(true);
+   m_output += html.m_html;
+   flush_if_full();
+   return *this;
+}
+
+auto cheap::html_writer::text(const escaped_text& escaped) -> html_writer&
+{
+   begin_child(true);
+   m_output += escaped.m_text;
+   flush_if_full();
+   return *this;
+}
+
+auto cheap::html_writer::text(const date_time time) -> html_writer&
+{
+   begin_child(true);
+   detail::write_text_str(time, m_options, m_output);
+   flush_if_full();
+   return *this;
+}
+
+auto cheap::html_writer::close() -> html_writer&
+{
+   if (m_open_elements.empty())
+      throw cheap_exception{ "There is no open element to close" };
+   const open_element& elem = m_open_elements.back();
+   if (elem.m_is_start_tag_open && elem.m_is_self_closing)
+   {
+      m_output += " />";
+   }
+   else if (elem.m_is_start_tag_open || m_first_text != std::string::npos)
+   {
+      if (elem.m_is_start_tag_open)
+         m_output += '>';
+      m_output += "</";
+      m_output += elem.m_name;
+      m_output += '>';
+   }
+   else
+   {
+      detail::sink_writer<std::string> writer{ m_output };
+      m_output += '\n';
+      detail::write_indentation_to(m_options.initial_level + static_cast<int>(m_open_elements.size()) - 1, m_options, writer);
+      m_output += "</";
+      m_output += elem.m_name;
+      m_output += '>';
+   }
+   m_first_text = std::string::npos;
+   m_open_elements.pop_back();
+   flush_if_full();
+   return *this;
+}
+
+auto cheap::html_writer::finish() -> void
+{
+   while (m_open_elements.empty() == false)
+      close();
+   if (m_root_count > 0 && m_options.end_with_newline)
+      m_output += '\n';
+   m_root_count = 0;
+   if (m_own_stream != nullptr)
+      m_own_stream->flush();
+}
+
+auto cheap::html_writer::get_depth() const -> std::size_t
+{
+   return m_open_elements.size();
+}
+
+auto cheap::html_writer::begin_child(const bool is_text) -> void
+{
+   const int level = m_options.initial_level + static_cast<int>(m_open_elements.size());
+   detail::sink_writer<std::string> writer{ m_output };
+   if (m_open_elements.empty())
+   {
+      // Top-level content is separated like the elements of a vector
+      if (m_root_count++ > 0)
+         m_output += '\n';
+      detail::write_indentation_to(level, m_options, writer);
+      return;
+   }
+
+   open_element& parent = m_open_elements.back();
+   if (parent.m_is_self_closing)
+   {
+      std::string msg = "The used element (\"";
+      msg += parent.m_name;
+      msg += "\") is self-closing and can't have children";
+      throw cheap_exception{ msg };
+   }
+   if (parent.m_is_start_tag_open)
+   {
+      m_output += '>';
+      parent.m_is_start_tag_open = false;
+   }
+   ++parent.m_child_count;
+   if (parent.m_child_count == 1 && is_text)
+   {
+      // Stays on the line of the tags if it's the only child
+      m_first_text = m_output.size();
+      return;
+   }
+   if (m_first_text != std::string::npos)
+   {
+      std::string line_start = "\n";
+      detail::sink_writer<std::string> line_writer{ line_start };
+      detail::write_indentation_to(level, m_options, line_writer);
+      m_output.insert(m_first_text, line_start);
+      m_first_text = std::string::npos;
+   }
+   m_output += '\n';
+   detail::write_indentation_to(level, m_options, writer);
+}
+
+auto cheap::html_writer::flush_if_full() -> void
+{
+   if (m_stream != nullptr && m_first_text == std::string::npos && m_output.size() >= detail::stream_output::chunk_size)
+      m_stream->flush();
+}
+
+auto cheap::text::take_cache(text& other) -> void
+{
+   if (other.m_state.load(std::memory_order_acquire) == cache_state::ready)
+   {
+      m_key = other.m_key;
+      m_escaped = std::move(other.m_escaped);
+      m_replacement_count = other.m_replacement_count;
+      m_state.store(cache_state::ready, std::memory_order_release);
+   }
+   other.set({});
+}
+
+
+auto cheap::literals::operator ""_att(const char* c_str, std::size_t) -> attribute
+{
+   std::string str(c_str);
+   const auto equal_pos = str.find('=');
+   attribute result;
+   if (equal_pos == std::string::npos)
+   {
+      result = bool_attribute{ .m_name = str };
+   }
+   else
+   {
+      result = string_attribute{
+         .m_name = str.substr(0, equal_pos),
+         .m_value = str.substr(equal_pos + 1)
+      };
+   }
+   detail::assert_attrib_valid(result);
+   return result;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+auto cheap::detail::assert_attrib_valid(const attribute& attrib) -> void
+{
+   // Check if global boolean attributes are used correctly
+   constexpr std::string_view bool_list[] = { "autofocus", "hidden", "itemscope" };
+   const auto attrib_name = get_attribute_name(attrib);
+   if (is_in(bool_list, attrib_name) && std::holds_alternative<bool_attribute>(attrib) == false)
+   {
+      std::string msg = "attribute \"";
+      msg += attrib_name;
+      msg += "\" must be boolean. It is not!";
+      throw cheap_exception{ msg };
+   }
+
+   // Check if global string attributes are used correctly
+   constexpr std::string_view string_attrib_list[] = { "accesskey", "class", "id", "is", "itemid", "itemref", "itemscope", "itemtype", "lang", "nonce", "part", "role", "slot", "style", "tabindex", "title" };
+   if(is_in(string_attrib_list, attrib_name) && std::holds_alternative<string_attribute>(attrib) == false)
+   {
+      std::string msg = "attribute \"";
+      msg += attrib_name;
+      msg += "\" must be a string. It is not!";
+      throw cheap_exception{ msg };
+   }
+
+   // Check if global enumerated attributes are used correctly
+   if (attrib_name == "autocapitalize")
+   {
+      constexpr std::string_view valid_list[] = { "off", "on", "sentences", "words", "characters" };
+      assert_string_enum_choice(attrib, valid_list);
+   }
+   else if (attrib_name == "contenteditable")
+   {
+      constexpr std::string_view valid_list[] = { "true", "false" };
+      assert_string_enum_choice(attrib, valid_list);
+   }
+   else if (attrib_name == "dir")
+   {
+      constexpr std::string_view valid_list[] = { "ltr", "rtl", "auto" };
+      assert_string_enum_choice(attrib, valid_list);
+   }
+   else if (attrib_name == "draggable")
+   {
+      constexpr std::string_view valid_list[] = { "true", "false" };
+      assert_string_enum_choice(attrib, valid_list);
+   }
+   else if (attrib_name == "enterkeyhint")
+   {
+      constexpr std::string_view valid_list[] = { "enter", "done", "go", "next", "previous", "search", "send" };
+      assert_string_enum_choice(attrib, valid_list);
+   }
+   else if (attrib_name == "inputmode")
+   {
+      constexpr std::string_view valid_list[] = { "none", "text", "decimal", "numeric", "tel", "search", "email", "url" };
+      assert_string_enum_choice(attrib, valid_list);
+   }
+   else if (attrib_name == "spellcheck")
+   {
+      constexpr std::string_view valid_list[] = { "true", "false" };
+      assert_string_enum_choice(attrib, valid_list);
+   }
+   else if (attrib_name == "translate")
+   {
+      constexpr std::string_view valid_list[] = { "yes", "no" };
+      assert_string_enum_choice(attrib, valid_list);
+   }
+}
+
+
+auto cheap::detail::assert_string_enum_choice(
+   const attribute& attrib,
+   const std::span<const std::string_view> choices
+) -> void
+{
+   if (std::holds_alternative<string_attribute>(attrib) == false)
+   {
+      std::string msg = "Attribute \"";
+      msg += get_attribute_name(attrib);
+      msg += "\" must be a string attribute. It's not!";
+      throw cheap_exception{ msg };
+   }
+
+   const auto attrib_name = get_attribute_name(attrib);
+   if (is_in(choices, attrib_name) == false)
+   {
+      std::string choices_str;
+      for (int i = 0; i < std::ssize(choices); ++i)
+      {
+         if (i > 0)
+            choices_str += ", ";
+         choices_str += choices[i];
+      }
+
+      std::string msg = "Attribute is an enum. It must be one of [";
+      msg += choices_str;
+      msg += "]. But it's \"";
+      msg += attrib_name;
+      msg += "\"!";
+      throw cheap_exception{msg};
+   }
+}
+
+
+auto cheap::detail::get_attribute_name(const attribute& attrib) -> std::string
+{
+   return std::visit(
+      [](const auto& alternative) {return alternative.m_name; },
+      attrib
+   );
+}
+
+
+auto cheap::detail::throw_invalid_utf8(const std::size_t offset) -> void
+{
+   throw cheap_exception{ "Invalid UTF-8 at byte " + std::to_string(offset) + " of a text" };
 }
 
 
-cheap::detail::indentation_helper::indentation_helper(const options& opt)
-   : m_indentation(opt.indentation)
-   , m_initial_level(opt.initial_level)
-   , m_current_level(m_initial_level)
+auto cheap::detail::is_self_closing(const std::string_view name) -> bool
 {
-   
+   return is_in(void_elements, name);
 }
 
 
+auto cheap::detail::is_in(const std::span<const std::string_view> choices, const std::string_view value) -> bool
+{
+   for (const auto& test : choices)
+   {
+      if (test == value)
+         return true;
+   }
+   return false;
+}
+
 
-auto cheap::get_element_str(
-   const element& elem,
-   const options& opt
-) -> std::string
+template<cheap::detail::element_like element_type, typename output_type>
+auto cheap::detail::write_element_str_impl(
+   const element_type& elem,
+   const indentation_helper& indentation,
+   const options& opt,
+   output_type& target,
+   render_map* map
+) -> void
 {
-   std::string result;
-   write_element_str(elem, result, opt);
-   return result;
+#ifdef CHEAP_CHECK_VIEWS
+   if constexpr (std::same_as<element_type, element_view>)
+      assert_views_unchanged(elem);
+#endif
+   std::string& output = get_buffer(target);
+   const std::size_t begin = output.size();
+   if (map != nullptr)
+      map->m_children.clear();
+   indentation.write_indentation_str(opt, output);
+   output += '<';
+   output += elem.m_name;
+   detail::write_attributes_str(elem.m_attributes, opt, output);
+
+   if(elem.is_self_closing())
+   {
+      if(elem.m_inner_html.empty() == false)
+      {
+         std::string msg = "The used element (\"";
+         msg += elem.m_name;
+         msg += "\") is self-closing and can't have children";
+         throw cheap_exception{ msg };
+      }
+
+      output += " /";
+
+   }
+   else if(elem.is_trivial())
+   {
+      output += '>';
+      if (map != nullptr && elem.m_inner_html.empty() == false)
+         map->m_children.emplace_back().m_offset = output.size();
+      if (elem.m_inner_html.empty() == false)
+         std::visit([&]<typename T>(const T& x) { if constexpr (text_like<T>) write_text_str(x, opt, target, get_content_context(elem.m_name)); }, elem.m_inner_html.front());
+      if (map != nullptr && elem.m_inner_html.empty() == false)
+         map->m_children.back().m_length = output.size() - map->m_children.back().m_offset;
+      output += "</";
+      output += elem.m_name;
+   }
+   else
+   {
+      output += '>';
+      output += '\n';
+      detail::get_inner_html_str(elem, indentation, opt, target, map);
+      output += '\n';
+      indentation.write_indentation_str(opt, output);
+      output += "</";
+      output += elem.m_name;
+   }
+
+   output += '>';
+   if (indentation.is_at_origin() && opt.end_with_newline)
+      output += '\n';
+
+   if (map != nullptr)
+   {
+      // Children were recorded with absolute offsets
+      for (render_map& child : map->m_children)
+         child.m_offset -= begin;
+      map->m_offset = begin;
+      map->m_length = output.size() - begin;
+   }
 }
+template auto cheap::detail::write_element_str_impl<cheap::element, std::string>(const element&, const indentation_helper&, const options&, std::string&, render_map*) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::element_view, std::string>(const element_view&, const indentation_helper&, const options&, std::string&, render_map*) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::element, cheap::scatter_output>(const element&, const indentation_helper&, const options&, scatter_output&, render_map*) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::element_view, cheap::scatter_output>(const element_view&, const indentation_helper&, const options&, scatter_output&, render_map*) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::element, cheap::detail::stream_output>(const element&, const indentation_helper&, const options&, stream_output&, render_map*) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::element_view, cheap::detail::stream_output>(const element_view&, const indentation_helper&, const options&, stream_output&, render_map*) -> void;
 
-auto cheap::get_element_str(
-   const std::vector<element>& elements,
+
+template<typename T>
+auto cheap::detail::write_attribute_alternative(
+   const T& alternative,
+   std::string& output,
    const options& opt
-) -> std::string
+) -> void
 {
-   std::string result;
-   write_element_str(elements, result, opt);
-   return result;
+   if constexpr (is_any_of<T, bool_attribute, bool_attribute_view>)
+   {
+      // The presence of a boolean string_attribute on an element represents the true
+      // value, and the absence of the string_attribute represents the false value.
+      // [...]]
+      // The values "true" and "false" are not allowed on boolean attributes.
+      // To represent a false value, the string_attribute has to be omitted altogether.
+      // [https://html.spec.whatwg.org/dev/common-microsyntaxes.html#boolean-attributes]
+      if (alternative.m_value == false)
+         return;
+      output += " ";
+      write_text_str(alternative.m_name, opt, output);
+   }
+   else if constexpr (is_any_of<T, string_attribute, string_attribute_view>)
+   {
+      output += ' ';
+      write_text_str(alternative.m_name, opt, output);
+      output += "=\"";
+      write_text_str(alternative.m_value, opt, output, get_attribute_context(alternative.m_name));
+      output += '\"';
+   }
 }
 
 
-auto cheap::write_element_str(
-   const element& elem,
+auto cheap::detail::write_attribute_string(
+   const attribute& attrib,
    std::string& output,
    const options& opt
 ) -> void
 {
-   output.clear();
-   detail::write_element_str_impl(elem, detail::indentation_helper(opt), opt, output);
+   std::visit([&](const auto& alternative) { write_attribute_alternative(alternative, output, opt); }, attrib);
 }
 
 
-auto cheap::write_element_str(
-   const std::vector<element>& elements,
+auto cheap::detail::write_attribute_string(
+   const attribute_view& attrib,
    std::string& output,
    const options& opt
 ) -> void
 {
-   output.clear();
+   std::visit([&](const auto& alternative) { write_attribute_alternative(alternative, output, opt); }, attrib);
+}
 
-   // Disable ending newlines in between and manually add it at the end if required
-   options intermediate_options = opt;
-   intermediate_options.end_with_newline = false;
-   for(int i=0; i<std::ssize(elements); ++i)
+
+template<typename attribute_range>
+auto cheap::detail::write_attributes_str(
+   const attribute_range& attributes,
+   const options& opt,
+   std::string& output
+) -> void
+{
+   for (const auto& x : attributes)
    {
-      detail::write_element_str_impl(elements[i], detail::indentation_helper(intermediate_options), intermediate_options, output);
-      if (i < (std::ssize(elements)-1))
-      {
-         output += '\n';
-      }
+      write_attribute_string(x, output, opt);
    }
-   if(opt.end_with_newline == true)
-      output += '\n';
 }
 
-cheap::element::element(
-   const std::string_view name,
-   std::vector<attribute> attributes,
-   std::vector<content> inner_html
-)
-   : m_name(name)
-   , m_attributes(std::move(attributes))
-   , m_inner_html(std::move(inner_html))
-{ }
-cheap::element::element(const std::string_view name, std::vector<content> inner_html)
-   : element(name, {}, std::move(inner_html))
-{ }
-cheap::element::element(const std::string_view name)
-   : element(name, {}, {})
-{ }
 
-auto cheap::element::is_trivial() const -> bool
+auto cheap::detail::write_repeated_char(
+   const int count,
+   const char ch,
+   std::string& output
+) -> void
 {
-   if (m_inner_html.empty())
-      return true;
+   if (count > 0)
+      output.append(static_cast<std::size_t>(count), ch);
+}
+
 
-   return m_inner_html.size() == 1 && std::holds_alternative<std::string>(m_inner_html.front());
+auto cheap::detail::write_text_str(
+   const std::string_view text,
+   const options& opt,
+   std::string& output,
+   const escape_context context
+) -> void
+{
+   sink_writer<std::string> writer{ output };
+   write_escaped_to(text, opt, writer, context);
 }
 
-auto cheap::element::get_trivial(const options& opt) const -> std::string
+
+auto cheap::detail::write_text_str(
+   const raw_html& html,
+   const options&,
+   std::string& output,
+   const escape_context
+) -> void
 {
-   if (m_inner_html.empty())
-      return "";
-   return detail::get_escaped(std::get<std::string>(m_inner_html.front()), opt);
+   output += html.m_html;
 }
 
-auto cheap::element::is_self_closing() const -> bool
+
+auto cheap::detail::write_text_str(
+   const escaped_text& text,
+   const options&,
+   std::string& output,
+   const escape_context
+) -> void
 {
-   constexpr std::string_view void_elem_list[] = { "area", "base", "br", "col", "embed", "hr", "img", "input", "link", "meta", "source", "track", "wbr" };
-   return detail::is_in(void_elem_list, m_name);
+   output += text.m_text;
 }
 
-auto cheap::literals::operator ""_att(const char* c_str, std::size_t) -> attribute
+
+auto cheap::detail::write_text_str(
+   const text& cached,
+   const options& opt,
+   std::string& output,
+   const escape_context context
+) -> void
 {
-   std::string str(c_str);
-   const auto equal_pos = str.find('=');
-   attribute result;
-   if (equal_pos == std::string::npos)
+   if (opt.escaping == false && opt.utf8 == utf8_handling::unchecked)
    {
-      result = bool_attribute{ .m_name = str };
+      output += cached.get();
+      return;
+   }
+   const std::uint8_t key = get_text_cache_key(opt, context);
+   if (const std::optional<std::string_view> escaped = cached.get_cached(key))
+   {
+      output += *escaped;
+      utf8_replacement_count += cached.get_cached_replacement_count();
+      return;
+   }
+   const std::size_t begin = output.size();
+   const std::size_t replacement_count = utf8_replacement_count;
+   write_text_str(std::string_view{ cached.get() }, opt, output, context);
+   cached.set_cached(key, std::string_view{ output }.substr(begin), utf8_replacement_count - replacement_count);
+}
+
+
+auto cheap::detail::get_text_cache_key(
+   const options& opt,
+   const escape_context context
+) -> std::uint8_t
+{
+   return static_cast<std::uint8_t>(static_cast<int>(context) | static_cast<int>(opt.utf8) << 2 | (opt.escaping ? 1 : 0) << 4);
+}
+
+
+auto cheap::detail::write_text_str(
+   const long long number,
+   const options&,
+   std::string& output,
+   const escape_context
+) -> void
+{
+   char buffer[24];
+   output.append(buffer, std::to_chars(std::begin(buffer), std::end(buffer), number).ptr);
+}
+
+
+auto cheap::detail::write_text_str(
+   const unsigned long long number,
+   const options&,
+   std::string& output,
+   const escape_context
+) -> void
+{
+   char buffer[24];
+   output.append(buffer, std::to_chars(std::begin(buffer), std::end(buffer), number).ptr);
+}
+
+
+auto cheap::detail::write_text_str(
+   const double number,
+   const options&,
+   std::string& output,
+   const escape_context
+) -> void
+{
+   // Shortest representation that round-trips
+   char buffer[32];
+   output.append(buffer, std::to_chars(std::begin(buffer), std::end(buffer), number).ptr);
+}
+
+
+auto cheap::detail::write_text_str(
+   const date_time time,
+   const options&,
+   std::string& output,
+   const escape_context
+) -> void
+{
+   char buffer[32];
+   output.append(buffer, to_chars_date_time(buffer, time));
+}
+
+
+template<cheap::detail::text_like text_type>
+auto cheap::detail::write_text_str(
+   const text_type& text,
+   const options& opt,
+   scatter_output& output,
+   const escape_context context
+) -> void
+{
+   const auto needs_escaping = [&](const std::string_view str) {
+      if (context == escape_context::raw_text)
+         return str.find("</") != std::string_view::npos;
+      return std::ranges::any_of(str, [&](const char ch) { return get_escape_sequence(ch, context).empty() == false; });
+   };
+   std::string_view verbatim;
+   std::size_t replacement_count = 0;
+   if constexpr (is_any_of<text_type, std::string, std::string_view>)
+   {
+      // Checking for escapes only pays off for texts that are referenced
+      if (text.size() >= output.m_reference_threshold && (opt.escaping == false || needs_escaping(text) == false)
+         && (opt.utf8 == utf8_handling::unchecked || is_valid_utf8(text)))
+         verbatim = text;
+   }
+   else if constexpr (std::same_as<text_type, raw_html>)
+      verbatim = text.m_html;
+   else if constexpr (std::same_as<text_type, escaped_text>)
+      verbatim = text.m_text;
+   else if constexpr (std::same_as<text_type, cheap::text>)
+   {
+      if (text.get().size() >= output.m_reference_threshold)
+      {
+         // The first render fills the cache, which can be referenced from then on
+         if (opt.escaping == false && opt.utf8 == utf8_handling::unchecked)
+            verbatim = text.get();
+         else if (const std::optional<std::string_view> escaped = text.get_cached(get_text_cache_key(opt, context)))
+         {
+            verbatim = *escaped;
+            replacement_count = text.get_cached_replacement_count();
+         }
+      }
+   }
+
+   if (verbatim.empty() == false && verbatim.size() >= output.m_reference_threshold)
+   {
+      output.append_reference(verbatim);
+      utf8_replacement_count += replacement_count;
    }
    else
+      write_text_str(text, opt, output.m_buffer, context);
+}
+
+
+template<cheap::detail::text_like text_type>
+auto cheap::detail::write_text_str(
+   const text_type& text,
+   const options& opt,
+   stream_output& output,
+   const escape_context context
+) -> void
+{
+   if constexpr (is_any_of<text_type, std::string, std::string_view>)
    {
-      result = string_attribute{
-         .m_name = str.substr(0, equal_pos),
-         .m_value = str.substr(equal_pos + 1)
-      };
+      // Long texts are escaped in pieces so the buffer doesn't grow with them. Pieces end between
+      // characters, and not between the '<' and '/' that raw text escapes together
+      std::string_view rest = text;
+      while (rest.empty() == false)
+      {
+         std::size_t split = std::min(rest.size(), stream_output::chunk_size);
+         for (std::size_t i = 1; i <= 3 && split < rest.size(); ++i)
+         {
+            const auto byte = static_cast<unsigned char>(rest[split - i]);
+            if ((byte & 0xC0) == 0x80)
+               continue;
+            const std::size_t length = byte >= 0xF0 ? 4 : byte >= 0xE0 ? 3 : byte >= 0xC0 ? 2 : 1;
+            if (length > i)
+               split -= i;
+            break;
+         }
+         if (split < rest.size() && rest[split - 1] == '<')
+            --split;
+         const std::string_view piece = rest.substr(0, split);
+         try
+         {
+            write_text_str(piece, opt, output.m_buffer, context);
+         }
+         catch (const cheap_exception&)
+         {
+            // Offsets of invalid UTF-8 are relative to the whole text
+            if (opt.utf8 != utf8_handling::validate)
+               throw;
+            std::size_t pos = 0;
+            while (pos < piece.size() && get_utf8_sequence(piece, pos).second)
+               pos += get_utf8_sequence(piece, pos).first;
+            throw_invalid_utf8(static_cast<std::size_t>(piece.data() - std::string_view{ text }.data()) + pos);
+         }
+         rest.remove_prefix(split);
+         flush_if_full(output);
+      }
    }
-   detail::assert_attrib_valid(result);
-   return result;
+   else if constexpr (is_any_of<text_type, raw_html, escaped_text>)
+   {
+      // Long verbatim texts are passed on directly
+      const std::string_view verbatim = [&] {
+         if constexpr (std::same_as<text_type, raw_html>)
+            return std::string_view{ text.m_html };
+         else
+            return std::string_view{ text.m_text };
+      }();
+      if (verbatim.size() < stream_output::chunk_size)
+      {
+         write_text_str(text, opt, output.m_buffer, context);
+         return;
+      }
+      output.flush();
+      output.m_stream.write(verbatim);
+      output.m_flushed_size += verbatim.size();
+   }
+   else
+   {
+      write_text_str(text, opt, output.m_buffer, context);
+   }
+}
+
+
+auto cheap::detail::get_buffer(std::string& output) -> std::string&
+{
+   return output;
+}
+
+
+auto cheap::detail::get_buffer(scatter_output& output) -> std::string&
+{
+   return output.m_buffer;
+}
+
+
+auto cheap::detail::get_buffer(stream_output& output) -> std::string&
+{
+   return output.m_buffer;
 }
 
 
+auto cheap::detail::stream_output::flush() -> void
+{
+   if (m_buffer.empty() == false)
+      m_stream.write(m_buffer);
+   m_flushed_size += m_buffer.size();
+   m_buffer.clear();
+}
+
 
+auto cheap::detail::to_chars_date_time(char* first, const date_time time) -> char*
+{
+   // ISO 8601 in UTC, as used by the datetime attribute: 2024-01-31T12:00:00Z
+   const auto days = std::chrono::floor<std::chrono::days>(time);
+   const std::chrono::year_month_day date{ days };
+   const std::chrono::hh_mm_ss clock{ time - days };
+   const auto write_padded = [&](long long value, const int width) {
+      // Years before 1 BC get the sign in front of the padding: -0001
+      if (value < 0)
+      {
+         *first++ = '-';
+         value = -value;
+      }
+      char digits[24];
+      char* const end = std::to_chars(std::begin(digits), std::end(digits), value).ptr;
+      for (auto padding = width - (end - digits); padding > 0; --padding)
+         *first++ = '0';
+      first = std::copy(digits, end, first);
+   };
+   write_padded(static_cast<int>(date.year()), 4);
+   *first++ = '-';
+   write_padded(static_cast<unsigned>(date.month()), 2);
+   *first++ = '-';
+   write_padded(static_cast<unsigned>(date.day()), 2);
+   *first++ = 'T';
+   write_padded(clock.hours().count(), 2);
+   *first++ = ':';
+   write_padded(clock.minutes().count(), 2);
+   *first++ = ':';
+   write_padded(clock.seconds().count(), 2);
+   *first++ = 'Z';
+   return first;
+}
 
 
+auto cheap::detail::is_same_leaf(const content& a, const content& b) -> bool
+{
+   if (a.index() != b.index())
+      return false;
+   const auto visitor = [&]<typename T>(const T& alternative) -> bool {
+      if constexpr (is_any_of<T, element, column_table, html_callback>)
+         return false; // Tables only view their data and callbacks can write anything, so it can't be told whether they changed
+      else
+         return alternative == std::get<T>(b);
+   };
+   return std::visit(visitor, a);
+}
 
 
+template<cheap::detail::text_like text_type, typename output_type>
+auto cheap::detail::write_element_str_impl(
+   const text_type& text,
+   const indentation_helper& indentation,
+   const options& opt,
+   output_type& target,
+   render_map* map,
+   const escape_context context
+) -> void
+{
+   std::string& output = get_buffer(target);
+   const std::size_t begin = output.size();
+   indentation.write_indentation_str(opt, output);
+   write_text_str(text, opt, target, context);
+   if (map != nullptr)
+   {
+      map->m_offset = begin;
+      map->m_length = output.size() - begin;
+   }
+}
 
 
+auto cheap::detail::get_row_count(const column_table& table) -> std::size_t
+{
+   if (table.m_header.empty() == false && table.m_header.size() != table.m_columns.size())
+      throw cheap_exception{ "The table header and the columns differ in size" };
+   if (table.m_column_attributes.empty() == false && table.m_column_attributes.size() != table.m_columns.size())
+      throw cheap_exception{ "The table column attributes and the columns differ in size" };
 
+   std::size_t row_count = 0;
+   for (std::size_t i = 0; i < table.m_columns.size(); ++i)
+   {
+      const std::size_t column_size = std::visit([](const auto& column) { return column.size(); }, table.m_columns[i]);
+      if (i > 0 && column_size != row_count)
+         throw cheap_exception{ "The table columns differ in size" };
+      row_count = column_size;
+   }
+   return row_count;
+}
 
 
-auto cheap::detail::assert_attrib_valid(const attribute& attrib) -> void
+template<typename output_type>
+auto cheap::detail::write_element_str_impl(
+   const column_table& table,
+   const indentation_helper& indentation,
+   const options& opt,
+   output_type& target,
+   render_map* map
+) -> void
 {
-   // Check if global boolean attributes are used correctly
-   constexpr std::string_view bool_list[] = { "autofocus", "hidden", "itemscope" };
-   const auto attrib_name = get_attribute_name(attrib);
-   if (is_in(bool_list, attrib_name) && std::holds_alternative<bool_attribute>(attrib) == false)
-   {
-      std::string msg = "attribute \"";
-      msg += attrib_name;
-      msg += "\" must be boolean. It is not!";
-      throw cheap_exception{ msg };
-   }
+   // Cells are short, so they are always written into the buffer
+   std::string& output = get_buffer(target);
+   // The output is the same as for table(thead(tr(th(...))), tbody(tr(td(...)))), but everything
+   // that doesn't depend on the row is prepared once
+   const std::size_t row_count = get_row_count(table);
+   const std::size_t begin = output.size();
 
-   // Check if global string attributes are used correctly
-   constexpr std::string_view string_attrib_list[] = { "accesskey", "class", "id", "is", "itemid", "itemref", "itemscope", "itemtype", "lang", "nonce", "part", "role", "slot", "style", "tabindex", "title" };
-   if(is_in(string_attrib_list, attrib_name) && std::holds_alternative<string_attribute>(attrib) == false)
+   std::string indentations[4];
+   indentation_helper level = indentation;
+   for (std::string& str : indentations)
    {
-      std::string msg = "attribute \"";
-      msg += attrib_name;
-      msg += "\" must be a string. It is not!";
-      throw cheap_exception{ msg };
+      str += '\n';
+      level.write_indentation_str(opt, str);
+      level = level.get_next_level();
    }
-
-   // Check if global enumerated attributes are used correctly
-   if (attrib_name == "autocapitalize")
+   // The markup between two cell values is constant: the closing tag of the previous cell (or the
+   // opening of the row) and the opening tag of the next one
+   std::vector<std::string> cell_prefixes(table.m_columns.size());
+   for (std::size_t i = 0; i < cell_prefixes.size(); ++i)
    {
-      constexpr std::string_view valid_list[] = { "off", "on", "sentences", "words", "characters" };
-      assert_string_enum_choice(attrib, valid_list);
+      if (i == 0)
+         cell_prefixes[i] = indentations[2] + "<tr>";
+      else
+         cell_prefixes[i] = "</td>";
+      cell_prefixes[i] += indentations[3];
+      cell_prefixes[i] += "<td";
+      if (table.m_column_attributes.empty() == false)
+         write_attributes_str(table.m_column_attributes[i], opt, cell_prefixes[i]);
+      cell_prefixes[i] += '>';
    }
-   else if (attrib_name == "contenteditable")
+   const std::string row_suffix = "</td>" + indentations[2] + "</tr>";
+
+   // Values are estimated to be short
+   std::size_t row_size = row_suffix.size();
+   for (const std::string& prefix : cell_prefixes)
+      row_size += prefix.size() + 16;
+   if constexpr (std::same_as<output_type, stream_output> == false)
+      output.reserve(output.size() + row_count * row_size);
+
+   const auto open_section = [&](const std::string_view name) {
+      output += indentations[1];
+      output += '<';
+      output += name;
+      output += '>';
+   };
+   const auto close_section = [&](const std::string_view name, const bool is_empty) {
+      if (is_empty == false)
+         output += indentations[1];
+      output += "</";
+      output += name;
+      output += '>';
+   };
+
+   indentation.write_indentation_str(opt, output);
+   output += "<table";
+   write_attributes_str(table.m_attributes, opt, output);
+   output += '>';
+   if (table.m_header.empty() == false)
    {
-      constexpr std::string_view valid_list[] = { "true", "false" };
-      assert_string_enum_choice(attrib, valid_list);
+      open_section("thead");
+      output += indentations[2];
+      output += "<tr>";
+      for (const std::string& title : table.m_header)
+      {
+         output += indentations[3];
+         output += "<th>";
+         write_text_str(std::string_view{ title }, opt, output);
+         output += "</th>";
+      }
+      output += indentations[2];
+      output += "</tr>";
+      close_section("thead", false);
    }
-   else if (attrib_name == "dir")
+   if (table.m_columns.empty() == false)
    {
-      constexpr std::string_view valid_list[] = { "ltr", "rtl", "auto" };
-      assert_string_enum_choice(attrib, valid_list);
+      open_section("tbody");
+      for (std::size_t row = 0; row < row_count; ++row)
+      {
+         for (std::size_t i = 0; i < table.m_columns.size(); ++i)
+         {
+            output += cell_prefixes[i];
+            const auto cell_writer = [&]<typename T>(const std::span<const T>& column) {
+               if constexpr (std::same_as<T, int>)
+                  write_text_str(static_cast<long long>(column[row]), opt, output);
+               else
+                  write_text_str(column[row], opt, output);
+            };
+            std::visit(cell_writer, table.m_columns[i]);
+         }
+         output += row_suffix;
+         flush_if_full(target);
+      }
+      close_section("tbody", row_count == 0);
    }
-   else if (attrib_name == "draggable")
+   if (table.m_header.empty() == false || table.m_columns.empty() == false)
+      output += indentations[0];
+   output += "</table>";
+   if (indentation.is_at_origin() && opt.end_with_newline)
+      output += '\n';
+
+   if (map != nullptr)
    {
-      constexpr std::string_view valid_list[] = { "true", "false" };
-      assert_string_enum_choice(attrib, valid_list);
+      map->m_offset = begin;
+      map->m_length = output.size() - begin;
    }
-   else if (attrib_name == "enterkeyhint")
+}
+template auto cheap::detail::write_element_str_impl<std::string>(const column_table&, const indentation_helper&, const options&, std::string&, render_map*) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::scatter_output>(const column_table&, const indentation_helper&, const options&, scatter_output&, render_map*) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::detail::stream_output>(const column_table&, const indentation_helper&, const options&, stream_output&, render_map*) -> void;
+
+
+template<typename output_type>
+auto cheap::detail::write_element_str_impl(
+   const html_callback& callback,
+   const indentation_helper& indentation,
+   const options& opt,
+   output_type& target,
+   render_map* map,
+   const escape_context context
+) -> void
+{
+   std::string& output = get_buffer(target);
+   const std::size_t begin = output.size();
+   options writer_options = opt;
+   writer_options.initial_level = indentation.get_level();
+   writer_options.end_with_newline = false;
+   const auto write = [&](html_writer& writer) {
+      if (callback.m_write)
+         callback.m_write(writer);
+      writer.finish();
+   };
+   if constexpr (std::same_as<output_type, stream_output>)
    {
-      constexpr std::string_view valid_list[] = { "enter", "done", "go", "next", "previous", "search", "send" };
-      assert_string_enum_choice(attrib, valid_list);
+      html_writer writer{ target, writer_options, context };
+      write(writer);
    }
-   else if (attrib_name == "inputmode")
+   else
    {
-      constexpr std::string_view valid_list[] = { "none", "text", "decimal", "numeric", "tel", "search", "email", "url" };
-      assert_string_enum_choice(attrib, valid_list);
+      html_writer writer{ output, writer_options, context };
+      write(writer);
    }
-   else if (attrib_name == "spellcheck")
+   if (map != nullptr)
    {
-      constexpr std::string_view valid_list[] = { "true", "false" };
-      assert_string_enum_choice(attrib, valid_list);
+      map->m_offset = begin;
+      map->m_length = output.size() - begin;
    }
-   else if (attrib_name == "translate")
+}
+template auto cheap::detail::write_element_str_impl<std::string>(const html_callback&, const indentation_helper&, const options&, std::string&, render_map*, const escape_context) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::scatter_output>(const html_callback&, const indentation_helper&, const options&, scatter_output&, render_map*, const escape_context) -> void;
+template auto cheap::detail::write_element_str_impl<cheap::detail::stream_output>(const html_callback&, const indentation_helper&, const options&, stream_output&, render_map*, const escape_context) -> void;
+
+
+template<cheap::detail::element_like element_type, typename output_type>
+auto cheap::detail::get_inner_html_str(
+   const element_type& elem,
+   const indentation_helper& indentation,
+   const options& opt,
+   output_type& target,
+   render_map* map
+) -> void
+{
+   std::string& output = get_buffer(target);
+   if (map != nullptr)
+      map->m_children.reserve(elem.m_inner_html.size());
+   const escape_context context = get_content_context(elem.m_name);
+   for(int i=0; i<std::ssize(elem.m_inner_html); ++i)
    {
-      constexpr std::string_view valid_list[] = { "yes", "no" };
-      assert_string_enum_choice(attrib, valid_list);
+      const auto& x = elem.m_inner_html[i];
+      if (i > 0)
+         output += '\n';
+      render_map* child_map = map != nullptr ? &map->m_children.emplace_back() : nullptr;
+      const auto content_visitor = [&]<typename T>(const T& alternative) -> void
+      {
+         if constexpr (text_like<T> || std::same_as<T, html_callback>)
+            write_element_str_impl(alternative, indentation.get_next_level(), opt, target, child_map, context);
+         else
+            write_element_str_impl(alternative, indentation.get_next_level(), opt, target, child_map);
+      };
+      std::visit(content_visitor, x);
+      flush_if_full(target);
    }
 }
 
 
-auto cheap::detail::assert_string_enum_choice(
-   const attribute& attrib,
-   const std::span<const std::string_view> choices
+auto cheap::detail::collect_changes(
+   const element& before,
+   const element& after,
+   content_path& path,
+   std::vector<content_path>& changes
 ) -> void
 {
-   if (std::holds_alternative<string_attribute>(attrib) == false)
+   // Anything that changes the layout of the element itself replaces the whole subtree
+   if (before.m_name != after.m_name
+      || before.m_attributes != after.m_attributes
+      || before.m_inner_html.size() != after.m_inner_html.size()
+      || before.is_trivial() != after.is_trivial())
    {
-      std::string msg = "Attribute \"";
-      msg += get_attribute_name(attrib);
-      msg += "\" must be a string attribute. It's not!";
-      throw cheap_exception{ msg };
+      changes.push_back(path);
+      return;
    }
 
-   const auto attrib_name = get_attribute_name(attrib);
-   if (is_in(choices, attrib_name) == false)
+   for (std::size_t i = 0; i < after.m_inner_html.size(); ++i)
    {
-      std::string choices_str;
-      for (int i = 0; i < std::ssize(choices); ++i)
-      {
-         if (i > 0)
-            choices_str += ", ";
-         choices_str += choices[i];
-      }
-
-      std::string msg = "Attribute is an enum. It must be one of [";
-      msg += choices_str;
-      msg += "]. But it's \"";
-      msg += attrib_name;
-      msg += "\"!";
-      throw cheap_exception{msg};
+      const content& before_child = before.m_inner_html[i];
+      const content& after_child = after.m_inner_html[i];
+      path.push_back(i);
+      if (before_child.index() != after_child.index())
+         changes.push_back(path);
+      else if (std::holds_alternative<element>(after_child))
+         collect_changes(std::get<element>(before_child), std::get<element>(after_child), path, changes);
+      else if (is_same_leaf(before_child, after_child) == false)
+         changes.push_back(path);
+      path.pop_back();
    }
 }
 
 
-auto cheap::detail::get_attribute_name(const attribute& attrib) -> std::string
+auto cheap::detail::rewrite_content(
+   const element& after,
+   const content_path& path,
+   std::string& output,
+   render_map& map,
+   const options& opt
+) -> void
 {
-   return std::visit(
-      [](const auto& alternative) {return alternative.m_name; },
-      attrib
-   );
-}
+   // Walk down to the parent of the changed content, remembering the maps along the way
+   std::vector<render_map*> chain{ &map };
+   const element* parent = &after;
+   indentation_helper indentation(opt);
+   std::size_t begin = map.m_offset;
+   for (std::size_t depth = 0; depth < path.size() - 1; ++depth)
+   {
+      parent = &std::get<element>(parent->m_inner_html[path[depth]]);
+      render_map& child_map = chain.back()->m_children[path[depth]];
+      begin += child_map.m_offset;
+      chain.push_back(&child_map);
+      indentation = indentation.get_next_level();
+   }
 
+   render_map& target_map = chain.back()->m_children[path.back()];
+   const std::size_t old_length = target_map.m_length;
+   std::string replacement;
+   render_map replacement_map;
+   if (parent->is_trivial())
+   {
+      // Text of trivial elements is written inline
+      replacement = parent->get_trivial(opt);
+   }
+   else
+   {
+      const auto content_visitor = [&]<typename T>(const T& alternative) -> void
+      {
+         if constexpr (text_like<T> || std::same_as<T, html_callback>)
+            write_element_str_impl(alternative, indentation.get_next_level(), opt, replacement, &replacement_map, get_content_context(parent->m_name));
+         else
+            write_element_str_impl(alternative, indentation.get_next_level(), opt, replacement, &replacement_map);
+      };
+      std::visit(content_visitor, parent->m_inner_html[path.back()]);
+   }
+   output.replace(begin + target_map.m_offset, old_length, replacement);
+   replacement_map.m_offset = target_map.m_offset;
+   replacement_map.m_length = replacement.size();
+   target_map = std::move(replacement_map);
 
-auto cheap::detail::is_in(const std::span<const std::string_view> choices, const std::string& value) -> bool
-{
-   for (const auto& test : choices)
+   // Shift the following siblings and grow the ancestors on every level
+   for (std::size_t level = 0; level < chain.size(); ++level)
    {
-      if (test == value)
-         return true;
+      std::vector<render_map>& siblings = chain[level]->m_children;
+      for (std::size_t i = path[level] + 1; i < siblings.size(); ++i)
+         siblings[i].m_offset = siblings[i].m_offset + replacement.size() - old_length;
+      chain[level]->m_length = chain[level]->m_length + replacement.size() - old_length;
    }
-   return false;
 }
 
 
-auto cheap::detail::write_element_str_impl(
-   const element& elem,
-   const indentation_helper& indentation,
+auto cheap::detail::write_patches(
+   const element& before,
+   const element& after,
+   content_path& path,
    const options& opt,
    std::string& output
 ) -> void
 {
-   indentation.write_indentation_str(opt, output);
-   output += '<';
-   output += elem.m_name;
-   detail::write_attributes_str(elem.m_attributes, opt, output);
-
-   if(elem.is_self_closing())
+   // Adjacent texts are a single text node in the DOM, so their indices don't address client nodes.
+   // Such elements are replaced as a whole when anything in them changed
+   const auto has_adjacent_texts = [](const element& elem) {
+      const auto is_text = [](const content& x) { return std::holds_alternative<element>(x) == false && std::holds_alternative<column_table>(x) == false; };
+      return std::ranges::adjacent_find(elem.m_inner_html, [&](const content& a, const content& b) { return is_text(a) && is_text(b); }) != elem.m_inner_html.end();
+   };
+   if (has_adjacent_texts(before) || has_adjacent_texts(after))
    {
-      if(elem.m_inner_html.empty() == false)
+      content_path changes_path;
+      std::vector<content_path> changes;
+      collect_changes(before, after, changes_path, changes);
+      if (changes.empty() == false)
       {
-         std::string msg = "The used element (\"";
-         msg += elem.m_name;
-         msg += "\") is self-closing and can't have children";
-         throw cheap_exception{ msg };
+         write_patch_head("replace", path, output);
+         write_patch_html(after, opt, output);
+         output += '}';
       }
+      return;
+   }
 
-      output += " /";
+   write_attribute_patches(before, after, path, output);
 
-   }
-   else if(elem.is_trivial())
+   const std::size_t common_size = std::min(before.m_inner_html.size(), after.m_inner_html.size());
+   for (std::size_t i = 0; i < common_size; ++i)
    {
-      output += '>';
-      output += elem.get_trivial(opt);
-      output += "</";
-      output += elem.m_name;
+      const content& before_child = before.m_inner_html[i];
+      const content& after_child = after.m_inner_html[i];
+      path.push_back(i);
+      if (std::holds_alternative<std::string>(before_child) && std::holds_alternative<std::string>(after_child))
+      {
+         if (std::get<std::string>(before_child) != std::get<std::string>(after_child))
+         {
+            write_patch_head("text", path, output);
+            output += ",\"value\":";
+            write_json_string(std::get<std::string>(after_child), output);
+            output += '}';
+         }
+      }
+      else if (std::holds_alternative<element>(before_child) && std::holds_alternative<element>(after_child)
+         && std::get<element>(before_child).m_name == std::get<element>(after_child).m_name)
+      {
+         write_patches(std::get<element>(before_child), std::get<element>(after_child), path, opt, output);
+      }
+      else if (is_same_leaf(before_child, after_child) == false)
+      {
+         write_patch_head("replace", path, output);
+         write_patch_html(after_child, opt, output);
+         output += '}';
+      }
+      path.pop_back();
    }
-   else
+
+   for (std::size_t i = common_size; i < after.m_inner_html.size(); ++i)
    {
-      output += '>';
-      output += '\n';
-      detail::get_inner_html_str(elem, indentation, opt, output);
-      output += '\n';
-      indentation.write_indentation_str(opt, output);
-      output += "</";
-      output += elem.m_name;
+      path.push_back(i);
+      write_patch_head("insert", path, output);
+      write_patch_html(after.m_inner_html[i], opt, output);
+      output += '}';
+      path.pop_back();
    }
 
-   output += '>';
-   if (indentation.is_at_origin() && opt.end_with_newline)
-      output += '\n';
+   // Back to front so the indices stay valid while the client applies them
+   for (std::size_t i = before.m_inner_html.size(); i > common_size; --i)
+   {
+      path.push_back(i - 1);
+      write_patch_head("remove", path, output);
+      output += '}';
+      path.pop_back();
+   }
 }
 
 
-auto cheap::detail::write_attribute_string(
-   const attribute& attrib,
-   std::string& output,
-   const options& opt
+auto cheap::detail::write_attribute_patches(
+   const element& before,
+   const element& after,
+   const content_path& path,
+   std::string& output
 ) -> void
 {
-   const auto visitor = [&]<is_alternative_c<attribute> T>(const T& alternative) -> void
+   if (before.m_attributes == after.m_attributes)
+      return;
+
+   const auto is_set = [](const attribute& attrib)
    {
-      if constexpr (std::same_as<T, bool_attribute>)
-      {
-         // The presence of a boolean string_attribute on an element represents the true
-         // value, and the absence of the string_attribute represents the false value.
-         // [...]]
-         // The values "true" and "false" are not allowed on boolean attributes.
-         // To represent a false value, the string_attribute has to be omitted altogether.
-         // [https://html.spec.whatwg.org/dev/common-microsyntaxes.html#boolean-attributes]
-         if (alternative.m_value == false)
-            return;
-         output += " ";
-         output += get_escaped(alternative.m_name, opt);
-      }
-      else if constexpr (std::same_as<T, string_attribute>)
+      return std::holds_alternative<string_attribute>(attrib) || std::get<bool_attribute>(attrib).m_value;
+   };
+   const auto find_set = [&](const attribute_list& attributes, const std::string& name) -> const attribute*
+   {
+      for (const attribute& attrib : attributes)
       {
-         output += ' ';
-         output += get_escaped(alternative.m_name, opt);
-         output += "=\"";
-         output += get_escaped(alternative.m_value, opt);
-         output += '\"';
+         if (is_set(attrib) && get_attribute_name(attrib) == name)
+            return &attrib;
       }
+      return nullptr;
    };
-   std::visit(visitor, attrib);
-}
-
 
-auto cheap::detail::write_attributes_str(
-   const std::vector<attribute>& attributes,
-   const options& opt,
-   std::string& output
-) -> void
-{
-   const auto visitor = [&]<typename T>(const T& alternative)
+   for (const attribute& attrib : after.m_attributes)
    {
-      write_attribute_string(alternative, output, opt);
-   };
-   
-   for (const auto& x : attributes)
+      if (is_set(attrib) == false)
+         continue;
+      const std::string name = get_attribute_name(attrib);
+      const attribute* previous = find_set(before.m_attributes, name);
+      if (previous != nullptr && *previous == attrib)
+         continue;
+      write_patch_head("set_attribute", path, output);
+      output += ",\"name\":";
+      write_json_string(name, output);
+      output += ",\"value\":";
+      if (std::holds_alternative<string_attribute>(attrib))
+         write_json_string(std::get<string_attribute>(attrib).m_value, output);
+      else
+         output += "\"\"";
+      output += '}';
+   }
+   for (const attribute& attrib : before.m_attributes)
    {
-      std::visit(visitor, x);
+      if (is_set(attrib) == false)
+         continue;
+      const std::string name = get_attribute_name(attrib);
+      if (find_set(after.m_attributes, name) != nullptr)
+         continue;
+      write_patch_head("remove_attribute", path, output);
+      output += ",\"name\":";
+      write_json_string(name, output);
+      output += '}';
    }
 }
 
 
-auto cheap::detail::write_repeated_char(
-   const int count,
-   const char ch,
+auto cheap::detail::write_patch_head(
+   const std::string_view op,
+   const content_path& path,
    std::string& output
 ) -> void
 {
-   for (int i = 0; i < count; ++i)
+   if (output.back() != '[')
+      output += ',';
+   output += "{\"op\":\"";
+   output += op;
+   output += "\",\"path\":[";
+   for (std::size_t i = 0; i < path.size(); ++i)
    {
-      output += ch;
+      if (i > 0)
+         output += ',';
+      output += std::to_string(path[i]);
    }
+   output += ']';
 }
 
 
-auto cheap::detail::replace_all(
-   std::string& inout,
-   const std::string_view what,
-   const std::string_view with
+auto cheap::detail::write_patch_html(
+   const content& html,
+   const options& opt,
+   std::string& output
 ) -> void
 {
-   std::size_t count{};
-   for (std::string::size_type pos{};
-      (pos = inout.find(what.data(), pos, what.length())) != std::string::npos;
-      pos += with.length(), ++count)
+   // Fragments are rendered on their own, without surrounding indentation or newline
+   options fragment_options = opt;
+   fragment_options.initial_level = 0;
+   fragment_options.end_with_newline = false;
+   std::string fragment;
+   const auto content_visitor = [&]<typename T>(const T& alternative) -> void
    {
-      inout.replace(pos, what.length(), with.data(), with.length());
-   }
-}
-
+      write_element_str_impl(alternative, indentation_helper(fragment_options), fragment_options, fragment, nullptr);
+   };
+   std::visit(content_visitor, html);
 
-auto cheap::detail::get_escaped(const std::string& in, const options& opt) -> std::string
-{
-   if (opt.escaping == false)
-      return in;
-   std::string result = in;
-   replace_all(result, "&", "&amp;");
-   replace_all(result, "<", "&lt;");
-   replace_all(result, ">", "&gt;");
-   return result;
+   output += ",\"html\":";
+   write_json_string(fragment, output);
 }
 
 
-auto cheap::detail::write_element_str_impl(
-   const std::string& elem,
-   const indentation_helper& indentation,
-   const options& opt,
+auto cheap::detail::write_json_string(
+   const std::string_view str,
    std::string& output
 ) -> void
 {
-   indentation.write_indentation_str(opt, output);
-   output += get_escaped(elem, opt);
+   constexpr char hex_digits[] = "0123456789abcdef";
+   output += '"';
+   for (const char ch : str)
+   {
+      switch (ch)
+      {
+      case '"':  output += "\\\""; break;
+      case '\\': output += "\\\\"; break;
+      case '\n': output += "\\n"; break;
+      case '\r': output += "\\r"; break;
+      case '\t': output += "\\t"; break;
+      default:
+         if (static_cast<unsigned char>(ch) < 0x20)
+         {
+            output += "\\u00";
+            output += hex_digits[ch >> 4];
+            output += hex_digits[ch & 0xf];
+         }
+         else
+            output += ch;
+      }
+   }
+   output += '"';
 }
 
 
-auto cheap::detail::get_inner_html_str(
-   const element& elem,
-   const indentation_helper& indentation,
-   const options& opt,
-   std::string& output
-) -> void
+auto cheap::detail::get_view_hashes(const element_view& elem) -> std::pair<std::size_t, std::size_t>
 {
-   const auto content_visitor = [&]<typename T>(const T& alternative) -> void
-   {
-      write_element_str_impl(alternative, indentation.get_next_level(), opt, output);
+   // FNV-1a over the view pointers and sizes, and over the viewed bytes
+   constexpr std::size_t prime = 1099511628211ull;
+   std::size_t identity = 14695981039346656037ull;
+   std::size_t checksum = identity;
+   const auto add_view = [&](const std::string_view view) {
+      identity = (identity ^ reinterpret_cast<std::uintptr_t>(view.data())) * prime;
+      identity = (identity ^ view.size()) * prime;
+      for (const char ch : view)
+         checksum = (checksum ^ static_cast<unsigned char>(ch)) * prime;
    };
 
-   for(int i=0; i<std::ssize(elem.m_inner_html); ++i)
+   add_view(elem.m_name);
+   for (const attribute_view& attrib : elem.m_attributes)
    {
-      const auto& x = elem.m_inner_html[i];
-      if (i > 0)
-         output += '\n';
-      std::visit(content_visitor, x);
+      std::visit([&]<typename T>(const T& alternative) {
+         add_view(alternative.m_name);
+         if constexpr (std::same_as<T, string_attribute_view>)
+            add_view(alternative.m_value);
+      }, attrib);
+   }
+   for (const content_view& content : elem.m_inner_html)
+   {
+      if (std::holds_alternative<std::string_view>(content))
+         add_view(std::get<std::string_view>(content));
    }
+   return { identity, checksum };
+}
+
+
+auto cheap::detail::assert_views_unchanged(const element_view& elem) -> void
+{
+#ifdef CHEAP_CHECK_VIEWS
+   // Views that were reassigned since construction can't be checked
+   const auto [identity, checksum] = get_view_hashes(elem);
+   if (identity == elem.m_debug_identity && checksum != elem.m_debug_checksum)
+   {
+      std::string msg = "The strings viewed by element_view \"";
+      msg += elem.m_name;
+      msg += "\" changed since its construction. They were modified or didn't outlive it";
+      throw cheap_exception{ msg };
+   }
+#else
+   (void)elem;
+#endif
 }
 #endif
@@ -0,0 +1,39 @@
+// Compile-time benchmark: 1000 builder calls over 100 element functions and 10 argument shapes.
+// Not part of the test project. Time the compilation of this file alone, for example with
+//    time g++ -std=c++20 -c compile_time_bench.cpp -o /dev/null
+//    Measure-Command { cl /std:c++latest /c compile_time_bench.cpp }
+
+#include "../cheap.h"
+
+#include <vector>
+
+using namespace cheap::literals;
+
+#define CHEAP_BENCH_TAGS(x) \
+   x(a) x(abbr) x(address) x(area) x(article) x(aside) x(audio) x(b) x(base) x(bdi) \
+   x(bdo) x(blockquote) x(body) x(br) x(button) x(canvas) x(caption) x(cite) x(code) x(col) \
+   x(colgroup) x(data) x(datalist) x(dd) x(del) x(details) x(dfn) x(dialog) x(div) x(dl) \
+   x(dt) x(em) x(embed) x(fieldset) x(figcaption) x(figure) x(footer) x(form) x(h1) x(h2) \
+   x(h3) x(h4) x(h5) x(h6) x(head) x(header) x(hr) x(html) x(i) x(iframe) \
+   x(img) x(input) x(ins) x(kdb) x(label) x(legend) x(li) x(link) x(main) x(map) \
+   x(mark) x(math) x(menu) x(meta) x(meter) x(nav) x(noscript) x(object) x(ol) x(optgroup) \
+   x(option) x(p) x(picture) x(portal) x(pre) x(progress) x(q) x(rp) x(rt) x(ruby) \
+   x(s) x(samp) x(script) x(section) x(select) x(slot) x(small_) x(source) x(span) x(stable) \
+   x(strong) x(style) x(sub) x(summary) x(sup) x(svg) x(tbody) x(td) x(template_) x(textarea)
+
+#define CHEAP_BENCH_SHAPES(tag) \
+   auto build_bench_##tag(const std::string& text, const cheap::attribute& attrib, const cheap::element& elem, std::vector<cheap::element>& out) -> void \
+   { \
+      out.push_back(cheap::tag()); \
+      out.push_back(cheap::tag("text")); \
+      out.push_back(cheap::tag(text)); \
+      out.push_back(cheap::tag("class=x"_att, "text")); \
+      out.push_back(cheap::tag("class=x"_att, cheap::span(text), "more")); \
+      out.push_back(cheap::tag(cheap::attribute{ attrib }, cheap::b("x"), cheap::i(text), cheap::element{ elem })); \
+      out.push_back(cheap::tag(cheap::bool_attribute{ "hidden" }, cheap::ul(cheap::li("1"), cheap::li("2"), cheap::li(text)))); \
+      out.push_back(cheap::tag(cheap::string_attribute{ "id", "main" }, cheap::p(cheap::em("a"), cheap::strong(text)), "tail")); \
+      out.push_back(cheap::tag(cheap::element{ elem }, cheap::element{ elem }, cheap::element{ elem })); \
+      out.push_back(cheap::tag("title=t"_att, "hidden"_att, std::string{ "moved" }, cheap::element{ "x" })); \
+   }
+
+CHEAP_BENCH_TAGS(CHEAP_BENCH_SHAPES)
@@ -1,4 +1,6 @@
+#include <filesystem>
 #include <fstream>
+#include <thread>
 
 // #define FMT_HEADER_ONLY
 // #include <fmt/format.h>
@@ -7,6 +9,10 @@
 #define CHEAP_IMPL
 #include "../cheap.h"
 
+#ifdef CHEAP_HAS_IOVEC
+#include <unistd.h>
+#endif
+
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 
@@ -70,6 +76,141 @@ TEST_CASE("escaping")
    }
 }
 
+TEST_CASE("escaping contexts") {
+   CHECK_EQ(get_element_str(div("title=say \"hi\""_att)), "<div title=\"say &quot;hi&quot;\"></div>\n");
+   CHECK_EQ(get_element_str(a("href=/a b?x=1&y=\xC3\xA9"_att)), "<a href=\"/a%20b?x=1&amp;y=%C3%A9\"></a>\n");
+   CHECK_EQ(get_element_str(script("if (a < b) x = '</script>';")), "<script>if (a < b) x = '<\\/script>';</script>\n");
+   CHECK_EQ(get_element_str(script("a < b"), options{ .escaping = false }), "<script>a < b</script>\n");
+   CHECK_EQ(get_element_str(div(script(i(), "a < b"))), "<div>\n    <script>\n        <i></i>\n        a < b\n    </script>\n</div>\n");
+
+   const std::string code = "a && b </style>";
+   const element elem = div("class=\"x\""_att, a("href=<x>"_att, "a<b"), style(code));
+   const std::string expected = get_element_str(elem);
+   CHECK_EQ(expected, "<div class=\"&quot;x&quot;\">\n    <a href=\"%3Cx%3E\">a&lt;b</a>\n    <style>a && b <\\/style></style>\n</div>\n");
+   const element_view view{ "div", { string_attribute_view{ "class", "\"x\"" } },
+      {
+         element_view{ "a", { string_attribute_view{ "href", "<x>" } }, { std::string_view{ "a<b" } } },
+         element_view{ "style", { std::string_view{ code } } }
+      }
+   };
+   CHECK_EQ(get_element_str(view), expected);
+   CHECK_EQ(get_snapshot_str(snapshot{ get_snapshot(elem) }), expected);
+   std::string expr_output;
+   expr::div("class=\"x\""_att, expr::a("href=<x>"_att, "a<b"), expr::style(code)).render_to(expr_output);
+   CHECK_EQ(expr_output, expected);
+
+   constexpr auto page = render_static([] {
+      return make_static<"p">(static_attribute{ "src=a b" }, make_static<"script">("1 < 2"));
+   });
+   CHECK_EQ(page.view(), "<p src=\"a%20b\">\n    <script>1 < 2</script>\n</p>\n");
+}
+
+TEST_CASE("utf-8 handling") {
+   const std::string valid = "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80 < &";
+   const std::string invalid = "a\xC3(b\xED\xA0\x80 c\xF0\x9F\x98";
+   const std::string replaced = "a\xEF\xBF\xBD(b\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD c\xEF\xBF\xBD";
+   constexpr options validate{ .utf8 = utf8_handling::validate };
+   constexpr options replace{ .utf8 = utf8_handling::replace };
+
+   CHECK_EQ(get_element_str(p(invalid), options{ .escaping = false }), "<p>" + invalid + "</p>\n");
+   CHECK_EQ(get_element_str(p(valid), validate), get_element_str(p(valid)));
+   CHECK_THROWS_AS(std::ignore = get_element_str(p(invalid), validate), cheap_exception);
+   CHECK_THROWS_AS(std::ignore = get_element_str(p("title=\xFF"_att), validate), cheap_exception);
+   CHECK_EQ(get_element_str(p(invalid), replace), "<p>" + replaced + "</p>\n");
+   CHECK_EQ(get_element_str(p(invalid), options{ .escaping = false, .utf8 = utf8_handling::replace }), "<p>" + replaced + "</p>\n");
+   CHECK_EQ(get_element_str(div(i(), "x<\xFF"), replace), "<div>\n    <i></i>\n    x&lt;\xEF\xBF\xBD\n</div>\n");
+   CHECK_EQ(get_element_str(a("href=/\xFF\xC3\xA9?a&b"_att), replace), "<a href=\"/%EF%BF%BD%C3%A9?a&amp;b\"></a>\n");
+   CHECK_EQ(get_element_str(script("</\xFF"), replace), "<script><\\/\xEF\xBF\xBD</script>\n");
+
+   const element elem = div("class=\"x\""_att, a("href=<x>"_att, valid), style("a </style> " + valid));
+   CHECK_EQ(get_element_str(elem, replace), get_element_str(elem));
+
+   render_context context{ replace };
+   std::string output;
+   context.render(ul(li(invalid), li(valid), li(invalid)), output);
+   CHECK_EQ(context.m_statistics.m_utf8_replacement_count, 10);
+
+   // Cached text counts its replacements on every render
+   render_context cached_context{ replace };
+   const element cached = p(text{ "a\xFF" });
+   cached_context.render(cached, output);
+   cached_context.render(cached, output);
+   CHECK_EQ(output, "<p>a\xEF\xBF\xBD</p>\n");
+   CHECK_EQ(cached_context.m_statistics.m_utf8_replacement_count, 2);
+   const element long_cached = p(text{ std::string(300, 'x') + "\xFF" });
+   std::ignore = get_element_str(long_cached, replace);
+   const std::size_t replacement_count = detail::utf8_replacement_count;
+   scatter_output cached_scatter;
+   write_element_scatter(long_cached, cached_scatter, replace);
+   CHECK_EQ(detail::utf8_replacement_count, replacement_count + 1);
+
+   const std::string long_invalid = std::string(300, 'x') + "\xFF";
+   scatter_output scatter;
+   write_element_scatter(p(long_invalid), scatter, replace);
+   std::string joined;
+   for (const std::string_view segment : scatter.get_segments())
+      joined += segment;
+   CHECK_EQ(joined, get_element_str(p(long_invalid), replace));
+}
+
+TEST_CASE("raw and pre-escaped content") {
+   CHECK_EQ(get_element_str(div(raw_html{ "<b>bold</b>" })), "<div><b>bold</b></div>\n");
+   CHECK_EQ(get_element_str(div(escaped_text{ "a&lt;b" })), "<div>a&lt;b</div>\n");
+   CHECK_EQ(get_element_str(div(i(), raw_html{ "<b>x</b>" }, "a<b")), "<div>\n    <i></i>\n    <b>x</b>\n    a&lt;b\n</div>\n");
+   CHECK_EQ(get_element_str(div(escaped_text{ "a<b" }), options{ .escaping = false }), "<div>a<b</div>\n");
+   CHECK_EQ(get_diff(div(raw_html{ "a" }), div(raw_html{ "b" })), std::vector<content_path>{ {0} });
+   CHECK(get_diff(div(raw_html{ "a" }), div(raw_html{ "a" })).empty());
+   CHECK_EQ(get_patch_str(div(raw_html{ "<i></i>" }), div(raw_html{ "<b></b>" })), R"([{"op":"replace","path":[0],"html":"<b></b>"}])");
+
+   std::string expr_output;
+   expr::div(expr::span(raw_html{ "<b>x</b>" }), escaped_text{ "&amp;" }).render_to(expr_output);
+   CHECK_EQ(expr_output, get_element_str(div(span(raw_html{ "<b>x</b>" }), escaped_text{ "&amp;" })));
+   CHECK_EQ(get_element_str(expr::p(raw_html{ "<br />" }).to_element()), "<p><br /></p>\n");
+}
+
+TEST_CASE("cached text") {
+   const std::string str = "a<b & c";
+   const element elem = div(p(text{ str }), i(), text{ str }, script(text{ "x </script>" }));
+   const std::string expected = get_element_str(div(p(str), i(), str, script("x </script>")));
+   CHECK_EQ(get_element_str(elem), expected);
+   CHECK_EQ(get_element_str(elem), expected);
+   CHECK_EQ(get_element_str(elem, options{ .escaping = false }), get_element_str(div(p(str), i(), str, script("x </script>")), options{ .escaping = false }));
+
+   const text& cached = std::get<text>(std::get<element>(elem.m_inner_html[0]).m_inner_html[0]);
+   CHECK_EQ(cached.get_cached(detail::get_text_cache_key(options{}, detail::escape_context::text)), "a&lt;b &amp; c");
+   CHECK_FALSE(cached.get_cached(detail::get_text_cache_key(options{}, detail::escape_context::attribute_value)).has_value());
+
+   text copy = cached;
+   CHECK_EQ(copy, cached);
+   CHECK(copy.get_cached(detail::get_text_cache_key(options{}, detail::escape_context::text)).has_value());
+   copy.set("x");
+   CHECK_FALSE(copy.get_cached(detail::get_text_cache_key(options{}, detail::escape_context::text)).has_value());
+   CHECK_EQ(get_element_str(p(copy)), "<p>x</p>\n");
+
+   std::string expr_output;
+   expr::div(expr::p(text{ str }), expr::i(), text{ str }, expr::script(text{ "x </script>" })).render_to(expr_output);
+   CHECK_EQ(expr_output, expected);
+   CHECK_EQ(get_snapshot_str(snapshot{ get_snapshot(elem) }), expected);
+
+   const element long_text = p(text{ std::string(300, 'x') });
+   const std::string& long_str = std::get<text>(long_text.m_inner_html.front()).get();
+   scatter_output output;
+   write_element_scatter(long_text, output);
+   output.clear();
+   write_element_scatter(long_text, output);
+   CHECK(std::ranges::any_of(output.get_segments(), [&](const std::string_view segment) { return segment.data() == long_str.data(); }));
+
+   const element shared = ul(li(text{ str }), li(text{ std::string(1'000, '<') }));
+   std::vector<std::string> outputs(4);
+   {
+      std::vector<std::jthread> threads;
+      for (std::string& thread_output : outputs)
+         threads.emplace_back([&] { for (int i = 0; i < 50; ++i) thread_output = get_element_str(shared); });
+   }
+   for (const std::string& thread_output : outputs)
+      CHECK_EQ(thread_output, get_element_str(ul(li(str), li(std::string(1'000, '<')))));
+}
+
 TEST_CASE("trailing newline") {
    SUBCASE("self-closing elements") {
       CHECK_EQ(get_element_str(br(), options{ .end_with_newline = true }), "<br />\n");
@@ -95,6 +236,1028 @@ TEST_CASE("vector interface + trailing newlines") {
    CHECK_EQ(get_element_str({ img(), img() }, options{ .end_with_newline = true }), "<img />\n<img />\n");
 }
 
+TEST_CASE("element function arguments") {
+   const element child = span("child");
+   const attribute attrib = "class=x"_att;
+   const std::string text = "text";
+   const std::string_view view = "view";
+   CHECK_EQ(get_element_str(div(attrib, child, text, view)), get_element_str(div("class=x"_att, span("child"), "text", "view")));
+   CHECK_EQ(get_element_str(create_element(std::string{ "x" }, text)), "<x>text</x>\n");
+   CHECK_THROWS_AS(std::ignore = create_element(""), cheap_exception);
+
+   std::string moved = "moved";
+   const element result = p(std::move(moved));
+   CHECK_EQ(std::get<std::string>(result.m_inner_html.front()), "moved");
+}
+
+TEST_CASE("element_view") {
+   const std::string name = "div";
+   const std::string text = "a<b";
+   const std::string value = "x";
+   const element_view view{ name, { bool_attribute_view{ "hidden" }, string_attribute_view{ "class", value } },
+      {
+         element_view{ "span", { std::string_view{ text } } },
+         std::string_view{ text },
+         element_view{ "br" }
+      }
+   };
+   CHECK_EQ(get_element_str(view), get_element_str(div("hidden"_att, "class=x"_att, span("a<b"), "a<b", br())));
+   CHECK_EQ(get_element_str(view, options{ .escaping = false, .end_with_newline = false }), get_element_str(div("hidden"_att, "class=x"_att, span("a<b"), "a<b", br()), options{ .escaping = false, .end_with_newline = false }));
+   CHECK_THROWS_AS(std::ignore = get_element_str(element_view{ "br", { std::string_view{ text } } }), cheap_exception);
+
+#ifdef CHEAP_CHECK_VIEWS
+   SUBCASE("changed strings are detected") {
+      std::string changing = "abc";
+      const element_view checked{ "p", { std::string_view{ changing } } };
+      CHECK_EQ(get_element_str(checked), "<p>abc</p>\n");
+      changing[0] = 'x';
+      CHECK_THROWS_AS(std::ignore = get_element_str(checked), cheap_exception);
+   }
+#endif
+}
+
+TEST_CASE("diff and incremental rewrite") {
+   const auto rewrite_helper = [](const element& before, const element& after, const options& opt = options{})
+   {
+      std::string output;
+      render_map map;
+      write_element_str(before, output, map, opt);
+      rewrite_element_str(after, get_diff(before, after), output, map, opt);
+
+      // The updated map must also serve the next rewrite
+      rewrite_element_str(before, get_diff(after, before), output, map, opt);
+      CHECK_EQ(output, get_element_str(before, opt));
+      rewrite_element_str(after, get_diff(before, after), output, map, opt);
+      return output;
+   };
+
+   SUBCASE("diff paths") {
+      CHECK(get_diff(div(span("a")), div(span("a"))).empty());
+      CHECK_EQ(get_diff(div(span("a"), span("b")), div(span("a"), span("c"))), std::vector<content_path>{ {1, 0} });
+      CHECK_EQ(get_diff(div(span("a")), div("class=x"_att, span("a"))), std::vector<content_path>{ {} });
+      CHECK_EQ(get_diff(div(i(), "x"), div(i(), span())), std::vector<content_path>{ {1} });
+      CHECK_EQ(get_diff(div(span("a")), div(span(i()))), std::vector<content_path>{ {0} });
+   }
+   SUBCASE("rewritten output matches a full render") {
+      const element before = div(span("a"), "text", ul(li("1"), li("2"), li("3")), p());
+      const element after = div(span("changed"), "other text", ul(li("1"), li("two"), li(b("3"))), p());
+      CHECK_EQ(rewrite_helper(before, after), get_element_str(after));
+      CHECK_EQ(rewrite_helper(before, after, options{ .indent_with_tab = true, .initial_level = 2, .end_with_newline = false }), get_element_str(after, options{ .indent_with_tab = true, .initial_level = 2, .end_with_newline = false }));
+      CHECK_EQ(rewrite_helper(before, div(span("a"))), get_element_str(div(span("a"))));
+      CHECK_EQ(rewrite_helper(div("a<b"), div("c&d")), get_element_str(div("c&d")));
+   }
+}
+TEST_CASE("patch stream") {
+   CHECK_EQ(get_patch_str(div(span("a")), div(span("a"))), "[]");
+   CHECK_EQ(get_patch_str(div(span("a")), div(span("b\"<"))), R"([{"op":"text","path":[0,0],"value":"b\"<"}])");
+   CHECK_EQ(get_patch_str(div("class=x"_att, "hidden"_att), div("class=y"_att)),
+      R"([{"op":"set_attribute","path":[],"name":"class","value":"y"},{"op":"remove_attribute","path":[],"name":"hidden"}])");
+   CHECK_EQ(get_patch_str(div(i()), div(b("x<y"), span())),
+      R"([{"op":"replace","path":[0],"html":"<b>x&lt;y</b>"},{"op":"insert","path":[1],"html":"<span></span>"}])");
+   CHECK_EQ(get_patch_str(ul(li(), li(), li()), ul(li())), R"([{"op":"remove","path":[2]},{"op":"remove","path":[1]}])");
+   CHECK_EQ(get_patch_str(div(), span()), R"([{"op":"replace","path":[],"html":"<span></span>"}])");
+   // Adjacent texts are one DOM text node, so their element is replaced
+   CHECK_EQ(get_patch_str(div("a", "b"), div("a", "c")), R"([{"op":"replace","path":[],"html":"<div>\n    a\n    c\n</div>"}])");
+   CHECK_EQ(get_patch_str(ul(li("x"), li("a", 1)), ul(li("x"), li("a", 2))), R"([{"op":"replace","path":[1],"html":"<li>\n    a\n    2\n</li>"}])");
+   CHECK_EQ(get_patch_str(div("a"), div("a", "b")), R"([{"op":"replace","path":[],"html":"<div>\n    a\n    b\n</div>"}])");
+   CHECK_EQ(get_patch_str(div("a", "b"), div("a", "b")), "[]");
+
+   SUBCASE("10k nodes with 1% churn") {
+      std::vector<content> before_items;
+      for (int i = 0; i < 10'000; ++i)
+         before_items.emplace_back(element{ "li", {"item " + std::to_string(i)} });
+      const element before{ "ul", before_items };
+      element after = before;
+      for (int i = 0; i < 10'000; i += 100)
+         std::get<element>(after.m_inner_html[i]).m_inner_html.front() = "changed";
+
+      const std::string patch = get_patch_str(before, after);
+      CHECK_EQ(std::count(patch.begin(), patch.end(), '{'), 100);
+      CHECK_LT(patch.size() * 20, get_element_str(after).size());
+   }
+}
+TEST_CASE("compile-time rendering") {
+   constexpr auto page = render_static([] {
+      return make_static<"div">(static_attribute{ "class=box" }, static_attribute{ "hidden" },
+         make_static<"span">("a<b"),
+         "text",
+         make_static<"br">()
+      );
+   });
+   static_assert(page.view().starts_with("<div class=\"box\" hidden>\n"));
+   CHECK_EQ(page.view(), get_element_str(div("class=box"_att, "hidden"_att, span("a<b"), "text", br())));
+
+   constexpr options opt{ .indent_with_tab = true, .initial_level = 1, .escaping = false, .end_with_newline = false };
+   constexpr auto indented = render_static<opt>([] { return make_static<"ul">(make_static<"li">("a<b"), make_static<"li">()); });
+   CHECK_EQ(indented.view(), get_element_str(ul(li("a<b"), li()), opt));
+}
+TEST_CASE("expression template elements") {
+   const auto render_helper = [](const auto& expression, const options& opt = options{})
+   {
+      std::string result;
+      expression.render_to(result, opt);
+      return result;
+   };
+   const std::string text = "a<b";
+   CHECK_EQ(render_helper(expr::div()), get_element_str(div()));
+   CHECK_EQ(render_helper(expr::div("class=x"_att, text)), get_element_str(div("class=x"_att, text)));
+   CHECK_EQ(render_helper(expr::div(bool_attribute{ "no", false }, expr::span(text), "x", expr::img())), get_element_str(div(bool_attribute{ "no", false }, span(text), "x", img())));
+   CHECK_EQ(render_helper(expr::ul(expr::li(text), li(b("y")))), get_element_str(ul(li(text), li(b("y")))));
+
+   constexpr options opt{ .indent_with_tab = true, .initial_level = 1, .escaping = false, .end_with_newline = false };
+   CHECK_EQ(render_helper(expr::ul(expr::li(text), li(b("y"))), opt), get_element_str(ul(li(text), li(b("y"))), opt));
+
+   CHECK_THROWS_AS(render_helper(expr::br("x")), cheap_exception);
+   CHECK_EQ(get_element_str(expr::div("hidden"_att, expr::span(text), "x").to_element()), get_element_str(div("hidden"_att, span(text), "x")));
+
+   // Lvalue arguments are stored as references and render the same as temporaries
+   const int number = 5;
+   const raw_html html{ "<i>x</i>" };
+   const cheap::text cached{ "a<b" };
+   CHECK_EQ(render_helper(expr::td(number)), get_element_str(td(number)));
+   CHECK_EQ(render_helper(expr::td(html)), get_element_str(td(html)));
+   CHECK_EQ(render_helper(expr::td(cached)), get_element_str(td(cached)));
+   CHECK_EQ(render_helper(expr::td(number)), "<td>5</td>\n");
+}
+
+
+TEST_CASE("numeric and date content") {
+   using namespace std::chrono_literals;
+   constexpr options opt_no_newline{ .end_with_newline = false };
+   const auto render_helper = [](const auto& expression)
+   {
+      std::string result;
+      expression.render_to(result);
+      return result;
+   };
+   CHECK_EQ(get_element_str(td(42)), "<td>42</td>\n");
+   CHECK_EQ(get_element_str(td(-7), opt_no_newline), "<td>-7</td>");
+   CHECK_EQ(get_element_str(td(18446744073709551615ull), opt_no_newline), "<td>18446744073709551615</td>");
+   CHECK_EQ(get_element_str(td(2.5), opt_no_newline), "<td>2.5</td>");
+   CHECK_EQ(get_element_str(td(1e100), opt_no_newline), "<td>1e+100</td>");
+   CHECK_EQ(get_element_str(time(date_time{ 0s }), opt_no_newline), "<time>1970-01-01T00:00:00Z</time>");
+   CHECK_EQ(get_element_str(time(date_time{ 1709210096s }), opt_no_newline), "<time>2024-02-29T12:34:56Z</time>");
+   CHECK_EQ(get_element_str(time(date_time{ std::chrono::sys_days{ std::chrono::year{ -1 } / 1 / 1 } }), opt_no_newline), "<time>-0001-01-01T00:00:00Z</time>");
+   CHECK_EQ(get_element_str(time(date_time{ std::chrono::sys_days{ std::chrono::year{ 12 } / 3 / 4 } }), opt_no_newline), "<time>0012-03-04T00:00:00Z</time>");
+   CHECK_EQ(get_element_str(p("a", 1, 2u), opt_no_newline), "<p>\n    a\n    1\n    2\n</p>");
+   CHECK_EQ(get_element_str(create_element("td", short{ 3 }, "class=x"_att), opt_no_newline), R"(<td class="x">3</td>)");
+
+   CHECK_EQ(render_helper(expr::td(42, "class=x"_att)), get_element_str(td(42, "class=x"_att)));
+   CHECK_EQ(render_helper(expr::td(0.1f)), "<td>0.1</td>\n");
+   CHECK_EQ(get_element_str(td(0.1f), opt_no_newline), "<td>0.1</td>");
+   CHECK_EQ(get_element_str(td(-3.4028235e38f), opt_no_newline), "<td>-3.4028235e+38</td>");
+   CHECK_EQ(render_helper(expr::p(date_time{ 0s }, 3)), get_element_str(p(date_time{ 0s }, 3)));
+   CHECK_EQ(get_element_str(expr::td(5u).to_element()), get_element_str(td(5u)));
+
+   CHECK(get_diff(td(1), td(1)).empty());
+   CHECK_EQ(get_diff(td(1), td(2)).size(), 1);
+   CHECK_EQ(get_diff(td(1), td("1")).size(), 1);
+}
+
+
+TEST_CASE("column table") {
+   const std::vector<std::string> names{ "a<b", "c" };
+   const std::vector<int> counts{ 1, -2 };
+   const std::vector<double> ratios{ 0.5, 2.0 };
+   const column_table table{
+      .m_header = { "Name", "Count", "Ratio" },
+      .m_columns = { names, counts, ratios },
+      .m_column_attributes = { {}, { "class=num"_att }, {} },
+      .m_attributes = { "id=t"_att }
+   };
+   const element expected = create_element("table", "id=t"_att,
+      thead(tr(th("Name"), th("Count"), th("Ratio"))),
+      tbody(
+         tr(td("a<b"), td("class=num"_att, 1), td(0.5)),
+         tr(td("c"), td("class=num"_att, -2), td(2.0))
+      )
+   );
+   CHECK_EQ(get_element_str(div(table)), get_element_str(div(expected)));
+   constexpr options opt{ .indent_with_tab = true, .initial_level = 1, .escaping = false };
+   CHECK_EQ(get_element_str(div(span("x"), table), opt), get_element_str(div(span("x"), expected), opt));
+   CHECK_EQ(get_element_str(div(column_table{})), get_element_str(div(create_element("table"))));
+   CHECK_EQ(get_element_str(div(column_table{ .m_columns = { std::span<const int>{} } })), get_element_str(div(create_element("table", tbody()))));
+   std::string expr_result;
+   expr::div(table).render_to(expr_result);
+   CHECK_EQ(expr_result, get_element_str(div(expected)));
+
+   CHECK_THROWS_AS(std::ignore = get_element_str(div(column_table{ .m_columns = { names, std::span<const int>{} } })), cheap_exception);
+   CHECK_THROWS_AS(std::ignore = get_element_str(div(column_table{ .m_header = { "x" } })), cheap_exception);
+}
+
+
+TEST_CASE("scatter output") {
+   const std::string long_text(1000, 'x');
+   const std::string long_escaped = std::string(1000, 'y') + "<";
+   const element elem = div(
+      p(long_text),
+      p("short"),
+      raw_html{ std::string(500, 'r') },
+      long_escaped,
+      span(7)
+   );
+   scatter_output output;
+   write_element_scatter(elem, output);
+
+   std::string joined;
+   for (const std::string_view segment : output.get_segments())
+      joined += segment;
+   CHECK_EQ(joined, get_element_str(elem));
+   CHECK_EQ(output.size(), joined.size());
+
+   const auto is_referenced = [&](const std::string& str) {
+      return std::ranges::any_of(output.get_segments(), [&](const std::string_view segment) { return segment.data() == str.data(); });
+   };
+   CHECK(is_referenced(std::get<std::string>(std::get<element>(elem.m_inner_html[0]).m_inner_html[0])));
+   CHECK(is_referenced(std::get<raw_html>(elem.m_inner_html[2]).m_html));
+   CHECK_FALSE(is_referenced(long_escaped));
+
+   options no_escaping{};
+   no_escaping.escaping = false;
+   write_element_scatter(elem, output, no_escaping);
+   CHECK(is_referenced(std::get<std::string>(elem.m_inner_html[3])));
+
+#ifdef CHEAP_HAS_IOVEC
+   write_element_scatter(elem, output);
+   int fds[2];
+   REQUIRE_EQ(pipe(fds), 0);
+   const std::vector<iovec> iovecs = output.get_iovecs();
+   CHECK_EQ(writev(fds[1], iovecs.data(), static_cast<int>(iovecs.size())), static_cast<ssize_t>(output.size()));
+   close(fds[1]);
+   std::string received;
+   char buffer[4096];
+   for (ssize_t count; (count = read(fds[0], buffer, sizeof(buffer))) > 0;)
+      received.append(buffer, count);
+   close(fds[0]);
+   CHECK_EQ(received, get_element_str(elem));
+
+   // More segments than IOV_MAX, written in groups
+   element many{ "div" };
+   for (int i = 0; i < 3000; ++i)
+      many.m_inner_html.emplace_back(raw_html{ std::to_string(i) + std::string(300, 'r') });
+   write_element_scatter(many, output);
+   CHECK_GT(output.get_iovecs().size(), 2048);
+   const std::string path = (std::filesystem::temp_directory_path() / "cheap_scatter_output.html").string();
+   std::FILE* file = std::fopen(path.c_str(), "wb");
+   REQUIRE(file != nullptr);
+   output.write_to(fileno(file));
+   std::fclose(file);
+   std::ifstream written_file{ path, std::ios::binary };
+   const std::string written{ std::istreambuf_iterator<char>{ written_file }, std::istreambuf_iterator<char>{} };
+   written_file.close();
+   std::filesystem::remove(path);
+   CHECK_EQ(written, get_element_str(many));
+   CHECK_THROWS_AS(output.write_to(-1), cheap_exception);
+#endif
+}
+
+
+TEST_CASE("stream and file output") {
+   element list{ "ul" };
+   for (int i = 0; i < 20'000; ++i)
+      list.m_inner_html.emplace_back(li("item ", i));
+   const std::vector<long long> numbers(50'000, 123456789);
+   const element elem = div(list, column_table{ .m_columns = { numbers } });
+   const std::string expected = get_element_str(elem);
+
+   struct chunk_stream final : output_stream
+   {
+      std::vector<std::string> m_chunks;
+      auto write(const std::string_view chunk) -> void override { m_chunks.emplace_back(chunk); }
+   };
+   chunk_stream stream;
+   write_element_stream(elem, stream);
+   CHECK_GT(stream.m_chunks.size(), 1);
+   std::string joined;
+   for (const std::string& chunk : stream.m_chunks)
+   {
+      CHECK_LT(chunk.size(), 2 * 64 * 1024);
+      joined += chunk;
+   }
+   CHECK_EQ(joined, expected);
+
+   const std::string path = (std::filesystem::temp_directory_path() / "cheap_file_output.html").string();
+   write_element_file(path, elem);
+   std::ifstream file{ path, std::ios::binary };
+   const std::string written{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+   file.close();
+   std::filesystem::remove(path);
+   CHECK_EQ(written, expected);
+
+   CHECK_THROWS_AS(write_element_file("/nonexistent_directory/x.html", elem), cheap_exception);
+
+   // Content that renders differently the second time can't overflow the mapping
+   for (const std::size_t second_size : { std::size_t{ 200000 }, std::size_t{ 2 } })
+   {
+      int call_count = 0;
+      const element changing = div(html_callback{ [&](html_writer& writer) {
+         writer.text(std::string(++call_count == 1 ? 10 : second_size, 'x'));
+      } });
+      CHECK_THROWS_AS(write_element_file(path, changing), cheap_exception);
+      CHECK_FALSE(std::filesystem::exists(path));
+   }
+
+   // Single huge texts are passed on in pieces too, split between characters
+   std::string huge_text;
+   for (int i = 0; huge_text.size() < 1'000'000; ++i)
+      huge_text += i % 7 == 0 ? "a</b <\xC3\xA9" : "x\xE2\x82\xAC";
+   for (const element& huge : { p(huge_text), script(huge_text), div(raw_html{ huge_text }) })
+   {
+      chunk_stream huge_stream;
+      write_element_stream(huge, huge_stream);
+      std::string huge_joined;
+      for (const std::string& chunk : huge_stream.m_chunks)
+      {
+         // Verbatim texts are passed on as they are, without copying them into the buffer
+         if (chunk.size() != huge_text.size())
+            CHECK_LT(chunk.size(), 5 * 64 * 1024 + 1);
+         huge_joined += chunk;
+      }
+      CHECK_EQ(huge_joined, get_element_str(huge));
+   }
+   const std::string invalid_text = std::string(200'000, 'x') + "\xFF";
+   chunk_stream invalid_stream;
+   CHECK_THROWS_WITH_AS(write_element_stream(p(invalid_text), invalid_stream, options{ .utf8 = utf8_handling::validate }), "Invalid UTF-8 at byte 200000 of a text", cheap_exception);
+}
+
+TEST_CASE("output iterators and formatters") {
+   const element elem = div("class=x"_att, p("a<b"), ul(li(1), li(2)));
+   const element_view view{ "p", { std::string_view{ "a<b" } } };
+
+   std::string output = "before ";
+   write_element_to(elem, std::back_inserter(output));
+   CHECK_EQ(output, "before " + get_element_str(elem));
+   std::vector<char> chars;
+   auto end = write_element_to(view, std::back_inserter(chars), options{ .end_with_newline = false });
+   *end = '!';
+   CHECK_EQ(std::string(chars.begin(), chars.end()), get_element_str(view, options{ .end_with_newline = false }) + "!");
+
+   // Nested calls from callbacks keep the options of the outer one
+   const element nested = div(html_callback{ [&](html_writer& writer) {
+      std::string inner;
+      write_element_to(p("a<b"), std::back_inserter(inner), options{ .escaping = false, .end_with_newline = false });
+      writer.text(raw_html{ inner });
+   } }, p("a<b"));
+   std::string nested_output;
+   write_element_to(nested, std::back_inserter(nested_output));
+   CHECK_EQ(nested_output, get_element_str(div(raw_html{ "<p>a<b</p>" }, p("a<b"))));
+
+#ifdef CHEAP_USE_FMT
+   CHECK_EQ(fmt::format("<body>{}</body>", elem), "<body>" + get_element_str(elem) + "</body>");
+   CHECK_EQ(fmt::format("{:2}", elem), get_element_str(elem, options{ .initial_level = 2 }));
+   CHECK_EQ(fmt::format("{}", view), get_element_str(view));
+   CHECK_THROWS_AS(std::ignore = fmt::format(fmt::runtime("{:x}"), elem), fmt::format_error);
+   fmt::memory_buffer buffer;
+   write_element_fmt(elem, buffer);
+   CHECK_EQ(fmt::to_string(buffer), get_element_str(elem));
+#endif
+#ifdef CHEAP_HAS_STD_FORMAT
+   CHECK_EQ(std::format("<body>{}</body>", elem), "<body>" + get_element_str(elem) + "</body>");
+   CHECK_EQ(std::format("{:1}", view), get_element_str(view, options{ .initial_level = 1 }));
+   std::string formatted;
+   std::format_to(std::back_inserter(formatted), "{}{}", elem, elem);
+   CHECK_EQ(formatted, get_element_str(elem) + get_element_str(elem));
+#endif
+}
+
+
+TEST_CASE("html_writer") {
+   const auto write = [](const std::function<void(html_writer&)>& fun, const options& opt = options{}) {
+      std::string output;
+      html_writer writer{ output, opt };
+      fun(writer);
+      writer.finish();
+      return output;
+   };
+
+   CHECK_EQ(write([](html_writer& w) { w.open("div").attr("class", "x").text("a<b").close(); }), get_element_str(div("class=x"_att, "a<b")));
+   CHECK_EQ(write([](html_writer& w) { w.open("div").text("abc").open("i").close().text(5).close(); }), get_element_str(div("abc", i(), 5)));
+   CHECK_EQ(write([](html_writer& w) { w.open("ul").open("li").text(1).close().open("li").attr("hidden").close(); }), get_element_str(ul(li(1), li("hidden"_att))));
+   CHECK_EQ(write([](html_writer& w) { w.open("img").attr("src", "a b").close().open("br"); }, options{ .end_with_newline = false }), get_element_str({ img("src=a b"_att), br() }, options{ .end_with_newline = false }));
+   CHECK_EQ(write([](html_writer& w) { w.open("script").text("a</b"); }, options{ .initial_level = 1 }), get_element_str(script("a</b"), options{ .initial_level = 1 }));
+   CHECK_EQ(write([](html_writer&) {}), "");
+
+   std::string output;
+   html_writer writer{ output };
+   CHECK_THROWS_AS(writer.attr("id", "x"), cheap_exception);
+   writer.open("br");
+   CHECK_THROWS_AS(writer.attr("hidden", "x"), cheap_exception);
+   CHECK_THROWS_AS(writer.attr("id"), cheap_exception);
+   CHECK_THROWS_AS(writer.text("abc"), cheap_exception);
+   CHECK_EQ(writer.get_depth(), 1);
+   writer.close();
+   CHECK_THROWS_AS(writer.close(), cheap_exception);
+
+   // Documents bigger than a chunk are flushed while they are written
+   struct string_stream final : output_stream
+   {
+      std::string m_str;
+      int m_write_count = 0;
+      auto write(const std::string_view chunk) -> void override { m_str += chunk; ++m_write_count; }
+   };
+   element list{ "ul" };
+   string_stream stream;
+   html_writer stream_writer{ stream };
+   stream_writer.open("ul");
+   for (int k = 0; k < 10000; ++k)
+   {
+      list.m_inner_html.emplace_back(li(k));
+      stream_writer.open("li").text(k).close();
+   }
+   stream_writer.finish();
+   CHECK_EQ(stream.m_str, get_element_str(list));
+   CHECK_GT(stream.m_write_count, 1);
+
+   // Callbacks write content inside of element trees
+   const html_callback rows{ [](html_writer& w) {
+      for (int k = 0; k < 3; ++k)
+         w.open("tr").open("td").text(k).close().close();
+   } };
+   const element with_callback = tbody("id=t"_att, rows, tr(td("end")));
+   const element equivalent = tbody("id=t"_att, tr(td(0)), tr(td(1)), tr(td(2)), tr(td("end")));
+   CHECK_EQ(get_element_str(with_callback), get_element_str(equivalent));
+   CHECK_EQ(get_element_str(div(rows), options{ .indent_with_tab = true, .initial_level = 1 }), get_element_str(div(tr(td(0)), tr(td(1)), tr(td(2))), options{ .indent_with_tab = true, .initial_level = 1 }));
+   string_stream callback_stream;
+   write_element_stream(with_callback, callback_stream);
+   CHECK_EQ(callback_stream.m_str, get_element_str(equivalent));
+   scatter_output scatter;
+   write_element_scatter(with_callback, scatter);
+   std::string joined;
+   for (const std::string_view segment : scatter.get_segments())
+      joined += segment;
+   CHECK_EQ(joined, get_element_str(equivalent));
+
+   // Text at the root of a callback is raw text inside script and style
+   const html_callback script_text{ [](html_writer& w) { w.text("a < b && c"); } };
+   const std::string raw_script = "<script>\n    a < b && c\n</script>\n";
+   CHECK_EQ(get_element_str(script(script_text)), raw_script);
+   CHECK_EQ(get_element_str(style(script_text)), "<style>\n    a < b && c\n</style>\n");
+   string_stream script_stream;
+   write_element_stream(script(script_text), script_stream);
+   CHECK_EQ(script_stream.m_str, raw_script);
+   std::string script_expr;
+   expr::script(script_text).render_to(script_expr);
+   CHECK_EQ(script_expr, raw_script);
+   CHECK_EQ(get_element_str(div(script_text)), "<div>\n    a &lt; b &amp;&amp; c\n</div>\n");
+}
+
+// Minimal inflater (RFC 1951) to check that compressed output decodes to the input
+static auto inflate(const std::string_view data) -> std::string
+{
+   std::size_t bit_position = 0;
+   const auto get_bits = [&](const int count) {
+      std::uint32_t result = 0;
+      for (int i = 0; i < count; ++i, ++bit_position)
+      {
+         if (bit_position / 8 >= data.size())
+            throw std::runtime_error{ "inflate: unexpected end" };
+         result |= ((static_cast<unsigned char>(data[bit_position / 8]) >> (bit_position % 8)) & 1u) << i;
+      }
+      return result;
+   };
+
+   // Canonical Huffman codes, decoded bit by bit by counting the codes of each length
+   struct huffman
+   {
+      std::array<int, 16> m_counts{};
+      std::vector<int> m_symbols;
+   };
+   const auto build = [](const std::span<const int> lengths) {
+      huffman result;
+      for (const int length : lengths)
+         ++result.m_counts[length];
+      result.m_counts[0] = 0;
+      std::array<int, 16> offsets{};
+      for (int i = 1; i < 16; ++i)
+         offsets[i] = offsets[i - 1] + result.m_counts[i - 1];
+      result.m_symbols.resize(lengths.size());
+      for (std::size_t symbol = 0; symbol < lengths.size(); ++symbol)
+         if (lengths[symbol] != 0)
+            result.m_symbols[offsets[lengths[symbol]]++] = static_cast<int>(symbol);
+      return result;
+   };
+   const auto decode = [&](const huffman& table) {
+      int code = 0, first = 0, index = 0;
+      for (int length = 1; length < 16; ++length)
+      {
+         code |= static_cast<int>(get_bits(1));
+         const int count = table.m_counts[length];
+         if (code - first < count)
+            return table.m_symbols[index + code - first];
+         index += count;
+         first = (first + count) << 1;
+         code <<= 1;
+      }
+      throw std::runtime_error{ "inflate: invalid code" };
+   };
+
+   constexpr int length_bases[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+   constexpr int length_extras[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+   constexpr int distance_bases[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+   constexpr int distance_extras[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+   std::string output;
+   bool is_final = false;
+   while (is_final == false)
+   {
+      is_final = get_bits(1) == 1;
+      const std::uint32_t type = get_bits(2);
+      if (type == 0)
+      {
+         bit_position = (bit_position + 7) / 8 * 8;
+         const std::uint32_t length = get_bits(16);
+         if ((get_bits(16) ^ 0xFFFF) != length || bit_position / 8 + length > data.size())
+            throw std::runtime_error{ "inflate: invalid stored block" };
+         output += data.substr(bit_position / 8, length);
+         bit_position += 8 * length;
+         continue;
+      }
+      if (type == 3)
+         throw std::runtime_error{ "inflate: invalid block type" };
+
+      std::vector<int> lengths(320, 0);
+      int literal_count = 288, distance_count = 32;
+      if (type == 1)
+      {
+         for (int i = 0; i < 288; ++i)
+            lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+         std::fill(lengths.begin() + 288, lengths.end(), 5);
+      }
+      else
+      {
+         literal_count = static_cast<int>(get_bits(5)) + 257;
+         distance_count = static_cast<int>(get_bits(5)) + 1;
+         const int code_length_count = static_cast<int>(get_bits(4)) + 4;
+         constexpr int order[] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+         std::vector<int> code_lengths(19, 0);
+         for (int i = 0; i < code_length_count; ++i)
+            code_lengths[order[i]] = static_cast<int>(get_bits(3));
+         const huffman code_length_table = build(code_lengths);
+         lengths.assign(literal_count + distance_count, 0);
+         for (int i = 0; i < literal_count + distance_count;)
+         {
+            const int symbol = decode(code_length_table);
+            if (symbol < 16)
+            {
+               lengths[i++] = symbol;
+               continue;
+            }
+            int repeated = 0, count = 0;
+            if (symbol == 16)
+            {
+               if (i == 0)
+                  throw std::runtime_error{ "inflate: repeat without length" };
+               repeated = lengths[i - 1];
+               count = 3 + static_cast<int>(get_bits(2));
+            }
+            else
+               count = symbol == 17 ? 3 + static_cast<int>(get_bits(3)) : 11 + static_cast<int>(get_bits(7));
+            if (i + count > literal_count + distance_count)
+               throw std::runtime_error{ "inflate: too many lengths" };
+            while (count-- > 0)
+               lengths[i++] = repeated;
+         }
+      }
+      const huffman literals = build(std::span<const int>(lengths).first(literal_count));
+      const huffman distances = build(std::span<const int>(lengths).subspan(literal_count, distance_count));
+      while (true)
+      {
+         const int symbol = decode(literals);
+         if (symbol < 256)
+         {
+            output += static_cast<char>(symbol);
+            continue;
+         }
+         if (symbol == 256)
+            break;
+         if (symbol > 285)
+            throw std::runtime_error{ "inflate: invalid length" };
+         const int length = length_bases[symbol - 257] + static_cast<int>(get_bits(length_extras[symbol - 257]));
+         const int distance_symbol = decode(distances);
+         if (distance_symbol > 29)
+            throw std::runtime_error{ "inflate: invalid distance" };
+         const std::size_t distance = distance_bases[distance_symbol] + get_bits(distance_extras[distance_symbol]);
+         if (distance > output.size())
+            throw std::runtime_error{ "inflate: distance too far back" };
+         for (int i = 0; i < length; ++i)
+            output += output[output.size() - distance];
+      }
+   }
+   return output;
+}
+
+TEST_CASE("compressed output") {
+   CHECK_EQ(detail::get_crc32(0, "123456789"), 0xCBF43926u);
+   CHECK_EQ(detail::get_adler32(1, "Wikipedia"), 0x11E60398u);
+
+   struct string_stream final : output_stream
+   {
+      std::string m_str;
+      auto write(const std::string_view chunk) -> void override { m_str += chunk; }
+   };
+   const auto read_number = [](const std::string_view str, const std::size_t offset) {
+      std::uint32_t result = 0;
+      for (int i = 3; i >= 0; --i)
+         result = (result << 8) | static_cast<unsigned char>(str[offset + i]);
+      return result;
+   };
+
+   // Stored blocks contain the input verbatim
+   const element elem = div(p("first"), p("second"));
+   const std::string html = get_element_str(elem);
+   string_stream stored;
+   compress_stream stored_stream{ stored, 0 };
+   write_element_stream(elem, stored_stream);
+   stored_stream.finish();
+   CHECK(stored.m_str.starts_with("\x1F\x8B\x08"));
+   CHECK_EQ(stored.m_str.size(), 10 + 5 + html.size() + 8);
+   CHECK_EQ(stored.m_str.substr(15, html.size()), html);
+   CHECK_EQ(read_number(stored.m_str, stored.m_str.size() - 8), detail::get_crc32(0, html));
+   CHECK_EQ(read_number(stored.m_str, stored.m_str.size() - 4), html.size());
+
+   element list{ "ul" };
+   for (int i = 0; i < 10'000; ++i)
+      list.m_inner_html.emplace_back(li("class=item"_att, "item ", i));
+   const std::string list_html = get_element_str(list);
+   string_stream compressed;
+   compress_stream gzip_stream{ compressed, 6 };
+   write_element_stream(list, gzip_stream);
+   gzip_stream.finish();
+   CHECK_LT(compressed.m_str.size(), list_html.size() / 10);
+   CHECK_EQ(read_number(compressed.m_str, compressed.m_str.size() - 8), detail::get_crc32(0, list_html));
+
+   string_stream zlib;
+   compress_stream zlib_stream{ zlib, 9, compression_format::zlib };
+   write_element_stream(list, zlib_stream);
+   zlib_stream.finish();
+   CHECK_EQ((static_cast<unsigned char>(zlib.m_str[0]) * 256 + static_cast<unsigned char>(zlib.m_str[1])) % 31, 0);
+
+   // Every level decodes to the input again, for both formats
+   std::string mixed = list_html;
+   for (std::uint32_t i = 0, value = 1; i < 100'000; ++i)
+   {
+      value = value * 1103515245u + 12345u;
+      mixed += static_cast<char>(value >> 24);
+   }
+   for (const std::string* input : std::initializer_list<const std::string*>{ &html, &list_html, &mixed })
+   {
+      for (int level = 0; level <= 9; ++level)
+      {
+         CAPTURE(level);
+         string_stream gzip_output;
+         compress_stream level_gzip{ gzip_output, level };
+         level_gzip.write(*input);
+         level_gzip.finish();
+         CHECK_EQ(inflate(std::string_view{ gzip_output.m_str }.substr(10, gzip_output.m_str.size() - 18)), *input);
+
+         string_stream zlib_output;
+         compress_stream level_zlib{ zlib_output, level, compression_format::zlib };
+         level_zlib.write(*input);
+         level_zlib.finish();
+         CHECK_EQ(inflate(std::string_view{ zlib_output.m_str }.substr(2, zlib_output.m_str.size() - 6)), *input);
+         std::uint32_t adler = 0;
+         for (std::size_t i = zlib_output.m_str.size() - 4; i < zlib_output.m_str.size(); ++i)
+            adler = (adler << 8) | static_cast<unsigned char>(zlib_output.m_str[i]);
+         CHECK_EQ(adler, detail::get_adler32(1, *input));
+      }
+   }
+   string_stream empty_output;
+   compress_stream empty_stream{ empty_output, 6 };
+   empty_stream.finish();
+   CHECK_EQ(inflate(std::string_view{ empty_output.m_str }.substr(10, empty_output.m_str.size() - 18)), "");
+
+   string_stream unused;
+   CHECK_THROWS_AS(compress_stream(unused, 10), cheap_exception);
+}
+
+
+TEST_CASE("content hash") {
+   const auto get_xxh64 = [](const std::string_view str) {
+      xxh64_hasher hasher;
+      hasher.update(str);
+      return hasher.get_digest();
+   };
+   const auto get_sha256_hex = [](const std::string_view str) {
+      sha256_hasher hasher;
+      hasher.update(str);
+      std::string result;
+      for (const std::uint8_t byte : hasher.get_digest())
+      {
+         result += "0123456789abcdef"[byte >> 4];
+         result += "0123456789abcdef"[byte & 0xF];
+      }
+      return result;
+   };
+   CHECK_EQ(get_xxh64(""), 0xEF46DB3751D8E999ull);
+   CHECK_EQ(get_xxh64("a"), 0xD24EC4F1A98C6E5Bull);
+   CHECK_EQ(get_xxh64("abc"), 0x44BC2CF5AD770999ull);
+   CHECK_EQ(get_sha256_hex(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+   CHECK_EQ(get_sha256_hex("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+   CHECK_EQ(get_sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+   // Hashing chunk by chunk while rendering gives the same result as hashing the output afterwards
+   element list{ "ul" };
+   for (int i = 0; i < 20'000; ++i)
+      list.m_inner_html.emplace_back(li("item ", i));
+   std::string output;
+   content_hash hash;
+   write_element_str(list, output, hash, options{}, true);
+   CHECK_EQ(output, get_element_str(list));
+   CHECK_EQ(hash.m_xxh64, get_xxh64(output));
+   REQUIRE(hash.m_sha256.has_value());
+   sha256_hasher whole;
+   whole.update(output);
+   CHECK_EQ(*hash.m_sha256, whole.get_digest());
+   CHECK_EQ(content_hash{ .m_xxh64 = 0x0123456789ABCDEFull }.get_etag(), "\"0123456789abcdef\"");
+
+   write_element_str(list, output, hash);
+   CHECK_FALSE(hash.m_sha256.has_value());
+}
+
+TEST_CASE("binary snapshot") {
+   const std::vector<std::string> names{ "a<b", "c" };
+   const std::vector<double> ratios{ 0.5, 2.0 };
+   const element elem = create_element("html",
+      create_element("body", "class=main"_att, "hidden"_att,
+         h1("Title & more"),
+         p("a", raw_html{ "<b>bold</b>" }, 42, date_time{ std::chrono::sys_days{ std::chrono::year{ 2024 } / 3 / 5 } }),
+         ul(li("one"), li("two"), li()),
+         column_table{ .m_header = { "Name", "Ratio" }, .m_columns = { names, ratios } },
+         create_element("img", "src=x.png"_att)
+      )
+   );
+   const std::string data = get_snapshot(elem);
+   const snapshot snap{ data };
+   CHECK_EQ(get_snapshot_str(snap), get_element_str(elem));
+   constexpr options opt{ .indent_with_tab = true, .initial_level = 1, .escaping = false };
+   CHECK_EQ(get_snapshot_str(snap, opt), get_element_str(elem, opt));
+
+   const std::string path = (std::filesystem::temp_directory_path() / "cheap_snapshot.bin").string();
+   {
+      std::ofstream file{ path, std::ios::binary };
+      file << data;
+   }
+   snapshot mapped = snapshot::open_file(path);
+   std::filesystem::remove(path);
+   const snapshot moved = std::move(mapped);
+   CHECK_EQ(get_snapshot_str(moved), get_element_str(elem));
+
+   CHECK_THROWS_AS(snapshot{ data.substr(0, 20) }, cheap_exception);
+   CHECK_THROWS_AS(snapshot{ data.substr(0, data.size() - 1) }, cheap_exception);
+   std::string wrong_magic = data;
+   wrong_magic[0] = 'X';
+   CHECK_THROWS_AS(snapshot{ wrong_magic }, cheap_exception);
+   std::string cyclic = data;
+   const std::uint32_t zero = 0;
+   std::memcpy(cyclic.data() + snap.m_header.m_nodes_offset + offsetof(snapshot::node, m_first_child), &zero, sizeof(zero));
+   CHECK_THROWS_AS(std::ignore = get_snapshot_str(snapshot{ cyclic }), cheap_exception);
+   CHECK_THROWS_AS(std::ignore = snapshot::open_file("/nonexistent_directory/x.bin"), cheap_exception);
+}
+
+TEST_CASE("parse_html") {
+   const element elem = create_element("html",
+      create_element("body", "class=main"_att, "hidden"_att,
+         h1("Title & <more>"),
+         p("a", create_element("br"), "b", span("x"), 42),
+         ul(li("one"), li("two"), li()),
+         create_element("img", "src=x.png?a=1&b=2"_att, "alt=a > b"_att)
+      )
+   );
+   const std::string html = get_element_str(elem);
+   const std::vector<element> parsed = parse_html(html);
+   REQUIRE_EQ(parsed.size(), 1);
+   CHECK_EQ(get_element_str(parsed.front()), html);
+   constexpr options opt{ .indent_with_tab = true, .initial_level = 2 };
+   CHECK_EQ(get_element_str(parse_html(get_element_str(elem, opt))), get_element_str(elem));
+   CHECK_EQ(get_element_str(parse_html(html + html)), html + html);
+
+   const std::vector<element> legacy = parse_html(
+      "<!DOCTYPE html><!-- <p>comment</p> -->\n<div id='a' data-x=1 checked>\n  caf&eacute; &lt;&#65;&#x263A;&quot;&gt;&nbsp;</div>"
+      "<br/><p class=\"x&amp;y\"/><script>if (a < b) {}</script>");
+   REQUIRE_EQ(legacy.size(), 4);
+   CHECK_EQ(get_element_str(legacy[0]), "<div id=\"a\" data-x=\"1\" checked>caf&amp;eacute; &lt;A\xE2\x98\xBA\"&gt;\xC2\xA0</div>\n");
+   CHECK_EQ(get_element_str(legacy[1]), "<br />\n");
+   CHECK_EQ(std::get<string_attribute>(legacy[2].m_attributes.front()).m_value, "x&y");
+   CHECK_EQ(get_element_str(legacy[3]), "<script>if (a < b) {}</script>\n");
+
+   // Whitespace around texts is dropped and adjacent texts are merged
+   const std::vector<element> texts = parse_html(get_element_str(div(" a ", "b")));
+   REQUIRE_EQ(texts.size(), 1);
+   REQUIRE_EQ(texts[0].m_inner_html.size(), 1);
+   CHECK_EQ(std::get<std::string>(texts[0].m_inner_html.front()), "a \n    b");
+
+   // Unquoted values end only at whitespace or '>'
+   const std::vector<element> urls = parse_html("<p><a href=/news/1>x</a><a href=http://x.com/a?b=c>y</a><img src=a/b.png><a href=x/>z</a></p>");
+   REQUIRE_EQ(urls.size(), 1);
+   CHECK_EQ(get_element_str(urls[0], options{ .end_with_newline = false }),
+      "<p>\n    <a href=\"/news/1\">x</a>\n    <a href=\"http://x.com/a?b=c\">y</a>\n    <img src=\"a/b.png\" />\n    <a href=\"x/\">z</a>\n</p>");
+
+   // References before and after the word-sized scan steps
+   const std::vector<element> long_text = parse_html("<p title='0123456789&amp;0123456789&quot;'>0123456789 &lt; 01234567&amp;x</p>");
+   REQUIRE_EQ(long_text.size(), 1);
+   CHECK_EQ(std::get<string_attribute>(long_text[0].m_attributes.front()).m_value, "0123456789&0123456789\"");
+   CHECK_EQ(std::get<std::string>(long_text[0].m_inner_html.front()), "0123456789 < 01234567&x");
+
+   CHECK(parse_html("  ").empty());
+   CHECK_THROWS_AS(std::ignore = parse_html("<div><p></div>"), cheap_exception);
+   CHECK_THROWS_AS(std::ignore = parse_html("<div>"), cheap_exception);
+   CHECK_THROWS_AS(std::ignore = parse_html("text"), cheap_exception);
+   CHECK_THROWS_AS(std::ignore = parse_html("<div a=\"x>"), cheap_exception);
+   CHECK_THROWS_AS(std::ignore = parse_html("<!-- x"), cheap_exception);
+}
+
+TEST_CASE("render context") {
+   element list{ "ul" };
+   for (int i = 0; i < 5'000; ++i)
+      list.m_inner_html.emplace_back(li("class=row"_att, "item <", i));
+   const element_view view{ "ul", { element_view{ "li", { std::string_view{ "a" } } }, element_view{ "li", { std::string_view{ "b" } } } } };
+   constexpr options opt{ .indent_with_tab = true, .initial_level = 1 };
+   render_context context{ opt };
+
+   std::string output;
+   context.render(list, output);
+   CHECK_EQ(output, get_element_str(list, opt));
+   const char* const data = output.data();
+   context.render(list, output);
+   CHECK_EQ(output.data(), data);
+   context.render(view, output);
+   CHECK_EQ(output, get_element_str(view, opt));
+   std::string fresh;
+   context.render(view, fresh);
+   CHECK_GE(fresh.capacity(), context.m_statistics.m_peak_size);
+
+   struct string_stream final : output_stream
+   {
+      std::string m_data;
+      auto write(const std::string_view chunk) -> void override { m_data += chunk; }
+   };
+   string_stream stream;
+   context.render(list, stream);
+   CHECK_EQ(stream.m_data, get_element_str(list, opt));
+   CHECK_GE(context.m_stream_buffer.capacity(), detail::stream_output::chunk_size);
+
+   CHECK_EQ(context.m_statistics.m_render_count, 5);
+   CHECK_EQ(context.m_statistics.m_peak_size, stream.m_data.size());
+   CHECK_EQ(context.m_statistics.m_byte_count, 3 * stream.m_data.size() + 2 * fresh.size());
+}
+
+TEST_CASE("output reservation") {
+   element list{ "ul" };
+   for (int k = 0; k < 200; ++k)
+      list.m_inner_html.emplace_back(li(k));
+   const template_key key{ "list" };
+   CHECK_EQ(get_reservation_statistics(key).m_reserved_size, 0);
+
+   std::string output;
+   write_element_str(list, output, key);
+   CHECK_EQ(output, get_element_str(list));
+   CHECK_EQ(get_element_str(list, key), output);
+   const reservation_statistics first = get_reservation_statistics(key);
+   CHECK_EQ(first.m_render_count, 2);
+   CHECK_EQ(first.m_regrowth_count, 1);
+   CHECK_EQ(first.m_reserved_size, output.size());
+
+   // Smaller pages only lower the reservation slowly
+   const element small = ul(li(1));
+   write_element_str(small, output, key);
+   const reservation_statistics second = get_reservation_statistics(key);
+   CHECK_LT(second.m_reserved_size, first.m_reserved_size);
+   CHECK_GT(second.m_reserved_size, get_element_str(small).size());
+   write_element_str(list, output, key);
+   CHECK_EQ(output, get_element_str(list));
+   CHECK_EQ(get_reservation_statistics(key).m_regrowth_count, 1);
+   CHECK_EQ(get_reservation_statistics(template_key{ "other" }).m_render_count, 0);
+   CHECK_EQ(get_element_str(small, {}), get_element_str(small));
+}
+
+TEST_CASE("batch rendering") {
+   std::vector<element> documents;
+   for (int i = 0; i < 200; ++i)
+   {
+      element list{ "ul" };
+      for (int j = 0; j < (i % 10 == 0 ? 2'000 : 3); ++j)
+         list.m_inner_html.emplace_back(li("item ", i, " ", j));
+      documents.emplace_back(std::move(list));
+   }
+
+   struct string_stream final : output_stream
+   {
+      std::string& m_data;
+      explicit string_stream(std::string& data) : m_data(data) {}
+      auto write(const std::string_view chunk) -> void override { m_data += chunk; }
+   };
+   std::vector<std::string> outputs(documents.size());
+   const batch_statistics statistics = render_batch(documents, options{}, [&](const std::size_t index) {
+      return std::make_unique<string_stream>(outputs[index]);
+   }, 4);
+   std::size_t byte_count = 0;
+   for (std::size_t i = 0; i < documents.size(); ++i)
+   {
+      CHECK_EQ(outputs[i], get_element_str(documents[i]));
+      byte_count += outputs[i].size();
+   }
+   CHECK_EQ(statistics.m_document_count, documents.size());
+   CHECK_EQ(statistics.m_byte_count, byte_count);
+   CHECK_EQ(statistics.m_thread_count, 4);
+   CHECK_GT(statistics.get_bytes_per_second(), 0.0);
+
+   CHECK_EQ(render_batch({}, options{}, [](const std::size_t) { return nullptr; }).m_document_count, 0);
+   struct null_stream final : output_stream
+   {
+      auto write(const std::string_view) -> void override {}
+   };
+   CHECK_THROWS_AS(std::ignore = render_batch(documents, options{}, [](const std::size_t index) -> std::unique_ptr<output_stream> {
+      if (index == 150)
+         throw cheap_exception{ "no output" };
+      return std::make_unique<null_stream>();
+   }, 3), cheap_exception);
+}
+
+TEST_CASE("small_vector") {
+   small_vector<std::string, 2> values{ "a", "b" };
+   CHECK(values.is_inline());
+   const std::string long_value(100, 'x');
+   values.push_back(long_value);
+   values.emplace_back(values.front());
+   CHECK_FALSE(values.is_inline());
+   CHECK_EQ(values.size(), 4);
+   CHECK_EQ(values[2], long_value);
+   CHECK_EQ(values.back(), "a");
+
+   small_vector<std::string, 2> copy = values;
+   CHECK_EQ(copy, values);
+   const small_vector<std::string, 2> moved = std::move(copy);
+   CHECK_EQ(moved, values);
+   CHECK(copy.empty());
+   small_vector<std::string, 2> inline_values{ long_value };
+   small_vector<std::string, 2> target = values;
+   target = std::move(inline_values);
+   CHECK_EQ(target.size(), 1);
+   CHECK_EQ(target.front(), long_value);
+   target.pop_back();
+   CHECK(target.empty());
+
+   small_vector<std::string, 0> no_inline{ std::vector<std::string>{ "x" } };
+   CHECK_EQ(sizeof(no_inline), sizeof(std::vector<std::string>));
+   CHECK_EQ(no_inline.front(), "x");
+
+   // Elements keep the vector interface for attributes
+   element elem{ "div", { "class=a"_att, "hidden"_att }, {} };
+   elem.m_attributes.push_back(string_attribute{ "id", "x" });
+   CHECK_EQ(get_element_str(elem), "<div class=\"a\" hidden id=\"x\"></div>\n");
+#if CHEAP_INLINE_ATTRIBUTES == 0
+   // Without inline storage they are a std::vector
+   std::vector<attribute>& attributes = elem.m_attributes;
+   attributes.erase(attributes.begin());
+   attributes.insert(attributes.begin(), string_attribute{ "lang", "en" });
+   attributes.resize(2);
+   CHECK_EQ(get_element_str(elem), "<div lang=\"en\" hidden></div>\n");
+   elem.m_attributes = std::vector<attribute>{ "id=y"_att };
+   CHECK_EQ(get_element_str(elem), "<div id=\"y\"></div>\n");
+#endif
+   const element copied_elem = elem;
+   CHECK_EQ(copied_elem.m_attributes, elem.m_attributes);
+}
+
+TEST_CASE("string pool") {
+   string_pool pool;
+   std::string text = "row";
+   const std::string_view first = pool.intern(text);
+   text = "changed";
+   CHECK_EQ(first, "row");
+   CHECK_EQ(pool.intern("row").data(), first.data());
+   CHECK_EQ(pool.intern(std::string(100'000, 'x')).size(), 100'000);
+   CHECK_EQ(pool.get_string_count(), 2);
+   CHECK_EQ(pool.get_byte_count(), 100'003);
+
+   const attribute_view class_attribute = pool.get_attribute("class=row");
+   CHECK_EQ(std::get<string_attribute_view>(class_attribute).m_value.data(), first.data());
+   const element_view view{ "ul", {}, {
+      element_view{ "li", { class_attribute, pool.get_attribute("hidden") }, { std::string_view{ "a" } } },
+      element_view{ "li", { pool.get_attribute("class=row"), pool.get_attribute("data-x=") }, {} }
+   } };
+   CHECK_EQ(get_element_str(view), get_element_str(ul(li("class=row"_att, "hidden"_att, "a"), li("class=row"_att, "data-x="_att))));
+   CHECK_THROWS_AS(std::ignore = pool.get_attribute("hidden=x"), cheap_exception);
+   CHECK_THROWS_AS(std::ignore = pool.get_attribute("hidden=x"), cheap_exception);
+
+   string_pool shared{ true };
+   std::vector<std::string_view> results(4);
+   {
+      std::vector<std::jthread> threads;
+      for (std::size_t i = 0; i < results.size(); ++i)
+      {
+         threads.emplace_back([&, i] {
+            for (int j = 0; j < 1'000; ++j)
+               std::ignore = shared.intern(std::to_string(j));
+            results[i] = shared.intern("same");
+         });
+      }
+   }
+   CHECK_EQ(shared.get_string_count(), 1'001);
+   for (const std::string_view result : results)
+      CHECK_EQ(result.data(), results.front().data());
+}
+
 
 
 // int main()